@@ -1,8 +1,13 @@
 #include <stdio.h>
+#include <string.h>
 #include <fcntl.h>
 #include <sys/mman.h>
 #include <unistd.h>
 #include "telex.h"
+#include "telexTranslit.h"
+#include "telexLayout.h"
+#include "telexLog.h"
+#include "telexCapture.h"
 
 //#include <sys/time.h>
 //#include <math.h>
@@ -37,6 +42,7 @@
 #define BAUDOT_WRU 0x09
 #define BAUDOT_BELL 0x0b
 #define BAUDOT_NULL 0x00
+#define BAUDOT_SPACE 0x04
 #define BAUDOT_ALPHABET_1 0x1f
 #define BAUDOT_ALPHABET_2 0x1b
 #define BAUDOT_NATIONAL_1 0x0d
@@ -55,32 +61,65 @@
 const uint8_t telex::alphabet1[32]={'*','e',0x0a,'a',' ','s', 'i','u',0x0d,'d','r','j','n','f','c','k','t','z','l','w','h','y','p','q','o','b','g','~','m','x','v','^'};
 const uint8_t telex::alphabet2[32]={'*','3',0x0a,'-',' ','\'','8','7',0x0d,'$','4','%',',','!',':','(','5','+',')','2','#','6','0','1','9','?','&','~','.','/','=','^'};
 
+// default symbol time, use setBaudrate to select another profile
 // SYMBOL_TIME = 20000 for 50 bd Telex (micro seconds)
 // SYMBOL_TIME = 22000 for 45.5 bd Telex (micro seconds)
 #define SYMBOL_TIME 20000
 
-telex::telex(uint8_t pinWriterOut, uint8_t pinKeyboardIn, uint8_t pinPowerControl, uint8_t pinColorControl, uint8_t legacyIOMapping, uint8_t powerTimout)
+const telexBaudProfile telex::baudProfiles[TELEX_BAUD_PROFILES]={
+	{"45.45",22000},
+	{"50",20000},
+	{"75",13333},
+	{"100",10000}
+};
+
+// stop time calibration: step size and pattern (r and y alternate all bits, then all letters)
+#define CALIBRATION_STEP_DIVIDER 10
+#define CALIBRATION_PATTERN "ryryryryryry thequickbrownfoxjumpsoverthelazydog"
+
+// carriage return model (micro seconds): the carriage needs CR_RETURN_TIME_BASE plus
+// CR_RETURN_TIME_PER_COLUMN for every column it travels back. sendChar always follows a <CR>
+// with a <LF>, so the carriage keeps returning while the <LF> is sent (7.5 symbols).
+#define CR_RETURN_TIME_BASE 40000
+#define CR_RETURN_TIME_PER_COLUMN 3000
+
+telex::telex(uint8_t pinWriterOut, uint8_t pinKeyboardIn, uint8_t pinPowerControl, uint8_t pinColorControl, uint8_t legacyIOMapping, uint8_t powerTimout, uint8_t simulate)
 {
 	this->currentAlphabet=0;
 	this->cursorPos=0;
 	this->powerState=0;
 	this->powerTimeout=powerTimout;
+	this->symbolTime=SYMBOL_TIME;
+	this->stopTime=SYMBOL_TIME*3/2;
+	this->simulate=simulate;
+	this->simulatedTime=0;
+	this->capture=0;
 
-	unsigned long gpio_base_offset=(legacyIOMapping)?GPIO_BASE_LEGACY:GPIO_BASE;
-	int mem_fd;
-	if ((mem_fd=open("/dev/mem",O_RDWR|O_SYNC))<0) throw telexMemoryException();
-
-	this->gpio = (volatile unsigned *) mmap(
-		NULL,             //Any adddress in our space will do
-		BLOCK_SIZE,       //Map length
-		PROT_READ|PROT_WRITE,// Enable reading & writting to mapped memory
-		MAP_SHARED,       //Shared with other processes
-		mem_fd,           //File to map
-		gpio_base_offset  //Offset to GPIO peripheral
-	);
-	close(mem_fd); //No need to keep mem_fd open after mmap
-
-	if (this->gpio==MAP_FAILED) throw telexMMAPException();
+	if (simulate)
+	{
+		// no hardware: registers live in memory and delays only advance simulatedTime
+		for (uint8_t zz=0;zz<TELEX_SIM_REGISTERS;zz++)
+			this->simulatedGpio[zz]=0;
+		this->gpio=this->simulatedGpio;
+	}
+	else
+	{
+		unsigned long gpio_base_offset=(legacyIOMapping)?GPIO_BASE_LEGACY:GPIO_BASE;
+		int mem_fd;
+		if ((mem_fd=open("/dev/mem",O_RDWR|O_SYNC))<0) throw telexMemoryException();
+
+		this->gpio = (volatile unsigned *) mmap(
+			NULL,             //Any adddress in our space will do
+			BLOCK_SIZE,       //Map length
+			PROT_READ|PROT_WRITE,// Enable reading & writting to mapped memory
+			MAP_SHARED,       //Shared with other processes
+			mem_fd,           //File to map
+			gpio_base_offset  //Offset to GPIO peripheral
+		);
+		close(mem_fd); //No need to keep mem_fd open after mmap
+
+		if (this->gpio==MAP_FAILED) throw telexMMAPException();
+	}
 
 	this->pinKeyboardIn=pinKeyboardIn; // input
 	INP_GPIO(this->pinKeyboardIn);
@@ -95,7 +134,7 @@ telex::telex(uint8_t pinWriterOut, uint8_t pinKeyboardIn, uint8_t pinPowerContro
 	OUT_GPIO(this->pinColorControl);
 	this->digitalWrite(this->pinColorControl,0,0);
 
-	usleep(500000);
+	this->delay(500000);
 
 	this->pinPowerControl=pinPowerControl; // output
 	INP_GPIO(this->pinPowerControl);
@@ -105,6 +144,53 @@ telex::telex(uint8_t pinWriterOut, uint8_t pinKeyboardIn, uint8_t pinPowerContro
 	this->ioPinMask=0;
 }
 
+telex::~telex()
+{
+	if (!this->simulate) munmap((void *)this->gpio,BLOCK_SIZE);
+	delete this->capture;
+}
+
+void telex::delay(unsigned long us)
+{
+	if (this->simulate)
+		this->simulatedTime+=us;
+	else
+		usleep(us);
+}
+
+void telex::enableCapture(size_t events)
+{
+	// record every GPIO write and read sample from now on (see telexCapture)
+	if (this->capture) return;
+	this->capture=new telexCapture(events);
+	this->capture->setPinName(this->pinWriterOut,"writer_out");
+	this->capture->setPinName(this->pinKeyboardIn,"keyboard_in");
+	this->capture->setPinName(this->pinPowerControl,"power");
+	this->capture->setPinName(this->pinColorControl,"color");
+}
+
+uint8_t telex::writeCapture(const char *path)
+{
+	// write the capture as VCD file and log the bit timing of the writer output
+	telexCaptureStats stats;
+
+	if (!this->capture) return 0;
+	this->capture->getStats(this->pinWriterOut,this->symbolTime,&stats);
+	telexLog(TELEX_LOG_INFO,TELEX_LOG_GENERAL,"[Capture: %lu events, %lu bit intervals, deviation mean %.0f us max %.0f us, %lu out of tolerance]\n",
+		(unsigned long)this->capture->size(),stats.intervals,stats.meanDeviation/1000,stats.maxDeviation/1000,stats.outOfTolerance);
+	return this->capture->writeVCD(path);
+}
+
+uint64_t telex::getTimestamp(void)
+{
+	// monotonic nano seconds, simulated time when there is no hardware
+	if (this->simulate)
+		return this->simulatedTime*1000ULL;
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC,&now);
+	return (uint64_t)now.tv_sec*1000000000ULL+now.tv_nsec;
+}
+
 unsigned telex::pin2Mask(uint8_t pin)
 {
 		return (1<<pin);
@@ -125,24 +211,51 @@ void telex::digitalWrite(uint8_t pin, uint8_t value, uint8_t filter)
 		else GPIO_CLR=mask;
 		this->ioPinMask&=~mask;
 	}
+	if (this->capture) this->capture->record(this->getTimestamp(),pin,value!=0,CAPTURE_WRITE);
+}
+
+void telex::writeMask(unsigned setMask, unsigned clearMask)
+{
+	// many pins in one store per register (the pins of a telexBank change together)
+	unsigned set=setMask&~this->ioPinMask, clear=clearMask&this->ioPinMask;
+	if (set) GPIO_SET=set;
+	if (clear) GPIO_CLR=clear;
+	this->ioPinMask=(this->ioPinMask|set)&~clear;
+	if (this->capture)
+	{
+		uint64_t now=this->getTimestamp();
+		for (unsigned changed=set|clear;changed;changed&=changed-1)
+		{
+			uint8_t pin=__builtin_ctz(changed);
+			this->capture->record(now,pin,(set>>pin)&1,CAPTURE_WRITE);
+		}
+	}
+}
+
+void telex::setOutput(uint8_t pin)
+{
+	INP_GPIO(pin);
+	OUT_GPIO(pin);
 }
 
 uint8_t telex::digitalRead(uint8_t pin)
 {
-	return (((GPIO_GET)&this->pin2Mask(pin))!=0);
+	uint8_t value=(((GPIO_GET)&this->pin2Mask(pin))!=0);
+	if (this->capture) this->capture->record(this->getTimestamp(),pin,value,CAPTURE_READ);
+	return value;
 }
 
 void telex::setColor(uint8_t redBlack)
 {
 	this->digitalWrite(this->pinColorControl,redBlack);
-  usleep(SYMBOL_TIME);
+  this->delay(this->symbolTime);
 }
 
 void telex::setPower(uint8_t onOff)
 {
 	this->digitalWrite(this->pinPowerControl,onOff);
 	this->powerState=onOff?time(NULL):0;
-  usleep(onOff?POWER_UP_DELAY:POWER_DOWN_DELAY);
+  this->delay(onOff?POWER_UP_DELAY:POWER_DOWN_DELAY);
 }
 
 uint8_t telex::getPower(void)
@@ -164,7 +277,7 @@ uint8_t telex::checkPowerTimeout(void)
 
 		if ((this->powerState)&&(difftime(time(NULL),this->powerState)>=this->powerTimeout))
 		{
-			printf("[Power timeout -> cut power!]\n");
+			telexLog(TELEX_LOG_INFO,TELEX_LOG_POWER,"[Power timeout -> cut power!]\n");
 			this->setPower(0);
 			return 1;
 		}
@@ -172,21 +285,26 @@ uint8_t telex::checkPowerTimeout(void)
 }
 
 uint8_t telex::getBaudotAlphabet(uint8_t *data)
+{
+	return telex::getBaudotAlphabet(data,this->currentAlphabet);
+}
+
+uint8_t telex::getBaudotAlphabet(uint8_t *data, uint8_t currentAlphabet)
 {
   for (uint8_t zz=0;zz<32;zz++)
   {  // first search in current alphabet to prevent unnecesarry switching
-     if (this->currentAlphabet==1)
+     if (currentAlphabet==1)
      {
-       if (this->alphabet1[zz]==data[0])
+       if (alphabet1[zz]==data[0])
          return 1;
-       if (this->alphabet2[zz]==data[0])
+       if (alphabet2[zz]==data[0])
          return 2;
      }
      else
      {
-       if (this->alphabet2[zz]==data[0])
+       if (alphabet2[zz]==data[0])
          return 2;
-       if (this->alphabet1[zz]==data[0])
+       if (alphabet1[zz]==data[0])
          return 1;
      }
   }
@@ -194,6 +312,11 @@ uint8_t telex::getBaudotAlphabet(uint8_t *data)
 }
 
 uint8_t telex::encodeBaudotChar(uint8_t *data)
+{
+	return telex::encodeBaudotChar(data,this->currentAlphabet);
+}
+
+uint8_t telex::encodeBaudotChar(uint8_t *data, uint8_t currentAlphabet)
 {
   // transform character so it is suitable to send to telex
   // function returns alphabet to be used
@@ -207,7 +330,7 @@ uint8_t telex::encodeBaudotChar(uint8_t *data)
   if ((data[0]=='"')||(data[0]=='`'))
 		data[0]='\'';
 
-	alphabet=this->getBaudotAlphabet(data);
+	alphabet=getBaudotAlphabet(data,currentAlphabet);
   if (!alphabet) // character not in alphabet, so replace with '+' character
   {
     data[0]='+';
@@ -218,7 +341,7 @@ uint8_t telex::encodeBaudotChar(uint8_t *data)
   {
     if (alphabet==1)
     {
-      if (this->alphabet1[zz]==data[0])
+      if (alphabet1[zz]==data[0])
       {
       	data[0]=zz;
       	zz=32;
@@ -226,7 +349,7 @@ uint8_t telex::encodeBaudotChar(uint8_t *data)
     }
     else
     {
-      if (this->alphabet2[zz]==data[0])
+      if (alphabet2[zz]==data[0])
       {
         data[0]=zz;
         zz=32;
@@ -269,22 +392,22 @@ void telex::printBaudotChar(uint8_t data)
 		switch(data)
 		{
 			case BAUDOT_NULL:
-				printf("<NULL>");
+				telexLog(TELEX_LOG_INFO,TELEX_LOG_ECHO,"<NULL>");
 				break;
 			case BAUDOT_CR:
-				printf("<CR>");
+				telexLog(TELEX_LOG_INFO,TELEX_LOG_ECHO,"<CR>");
 				break;
 			case BAUDOT_LF:
-				printf("<LF>\n");
+				telexLog(TELEX_LOG_INFO,TELEX_LOG_ECHO,"<LF>\n");
 				break;
 			case BAUDOT_ALPHABET_1:
-				printf("<ALPHABET1>");
+				telexLog(TELEX_LOG_INFO,TELEX_LOG_ECHO,"<ALPHABET1>");
 				break;
 			case BAUDOT_ALPHABET_2:
-				printf("<ALPHABET2>");
+				telexLog(TELEX_LOG_INFO,TELEX_LOG_ECHO,"<ALPHABET2>");
 				break;
 			default:
-				printf("%c",this->decodeBaudotChar(data));
+				telexLog(TELEX_LOG_INFO,TELEX_LOG_ECHO,"%c",this->decodeBaudotChar(data));
 				break;
 		}
 	}
@@ -293,43 +416,48 @@ void telex::printBaudotChar(uint8_t data)
 		switch(data)
 		{
 			case BAUDOT_BELL:
-				printf("<BELL>");
+				telexLog(TELEX_LOG_INFO,TELEX_LOG_ECHO,"<BELL>");
 				break;
 			case BAUDOT_WRU:
-				printf("<WRU?>");
+				telexLog(TELEX_LOG_INFO,TELEX_LOG_ECHO,"<WRU?>");
 				break;
 			case BAUDOT_NULL:
-				printf("<NULL>");
+				telexLog(TELEX_LOG_INFO,TELEX_LOG_ECHO,"<NULL>");
 				break;
 			case BAUDOT_CR:
-				printf("<CR>");
+				telexLog(TELEX_LOG_INFO,TELEX_LOG_ECHO,"<CR>");
 				break;
 			case BAUDOT_LF:
-				printf("<LF>\n");
+				telexLog(TELEX_LOG_INFO,TELEX_LOG_ECHO,"<LF>\n");
 				break;
 			case BAUDOT_ALPHABET_1:
-				printf("<ALPHABET1>");
+				telexLog(TELEX_LOG_INFO,TELEX_LOG_ECHO,"<ALPHABET1>");
 				break;
 			case BAUDOT_ALPHABET_2:
-				printf("<ALPHABET2>");
+				telexLog(TELEX_LOG_INFO,TELEX_LOG_ECHO,"<ALPHABET2>");
 				break;
 			case BAUDOT_NATIONAL_1:
-				printf("<NATIONAL1>");
+				telexLog(TELEX_LOG_INFO,TELEX_LOG_ECHO,"<NATIONAL1>");
 				break;
 			case BAUDOT_NATIONAL_2:
-				printf("<NATIONAL2>");
+				telexLog(TELEX_LOG_INFO,TELEX_LOG_ECHO,"<NATIONAL2>");
 				break;
 			case BAUDOT_NATIONAL_3:
-				printf("<NATIONAL3>");
+				telexLog(TELEX_LOG_INFO,TELEX_LOG_ECHO,"<NATIONAL3>");
 				break;
 			default:
-				printf("%c",this->decodeBaudotChar(data));
+				telexLog(TELEX_LOG_INFO,TELEX_LOG_ECHO,"%c",this->decodeBaudotChar(data));
 				break;
 		}
 	}
 }
 
 void telex::updateState(uint8_t data)
+{
+	telex::updateState(data,&this->currentAlphabet,&this->cursorPos);
+}
+
+void telex::updateState(uint8_t data, uint8_t *currentAlphabet, uint8_t *cursorPos)
 {
 	switch(data) // set current alphabet and update cursor position
 	{
@@ -339,28 +467,52 @@ void telex::updateState(uint8_t data)
 			break;
 		case BAUDOT_ALPHABET_1:
 		case BAUDOT_ALPHABET_2:
-			this->currentAlphabet=(data==BAUDOT_ALPHABET_1)?1:2;
-			//printf("Alphabet switched to %d\n",this->currentAlphabet);
+			*currentAlphabet=(data==BAUDOT_ALPHABET_1)?1:2;
+			//printf("Alphabet switched to %d\n",*currentAlphabet);
 			break;
 		case BAUDOT_CR:
 			//printf("Reset cursor pos!\n");
-			this->cursorPos=0;
+			*cursorPos=0;
 			break;
 		case BAUDOT_BELL:
-			if (this->currentAlphabet==1)
+			if (*currentAlphabet==1)
 			{
 				//printf("Print char (increment)!\n");
-				this->cursorPos++;
+				(*cursorPos)++;
 			}
 			else
 				//printf("No print char!\n");
 			break;
 		default:
 			//printf("Print char (increment)!\n");
-			this->cursorPos++;
+			(*cursorPos)++;
 			break;
 	}
-	//printf("Current pos=%d\n",this->cursorPos);
+	//printf("Current pos=%d\n",*cursorPos);
+}
+
+unsigned long telex::getReturnSettleTime(uint8_t column)
+{
+	// stop time needed after a <CR> from the given column before the next symbol may follow
+	unsigned long returnTime=CR_RETURN_TIME_BASE+(unsigned long)column*CR_RETURN_TIME_PER_COLUMN;
+	unsigned long overlap=this->symbolTime*6+this->stopTime; // carriage returns during the following <LF>
+	if (returnTime<=overlap+this->stopTime)
+		return this->stopTime; // short line: normal stop time
+	return returnTime-overlap;
+}
+
+unsigned long telex::getStopTime(uint8_t data)
+{
+	return this->getStopTime(data,this->cursorPos);
+}
+
+unsigned long telex::getStopTime(uint8_t data, uint8_t column)
+{
+	if ((data==BAUDOT_ALPHABET_1)||(data==BAUDOT_ALPHABET_2))
+		return this->symbolTime*5; // allow for some extra time to perform mechanical alphabet switch
+	if (data==BAUDOT_CR)
+		return this->getReturnSettleTime(column); // allow the carriage to return from the given column
+	return this->stopTime; // 1.5 stopbits unless calibrated (see calibrateStopTime)
 }
 
 void telex::sendRawChar(uint8_t data)
@@ -370,18 +522,15 @@ void telex::sendRawChar(uint8_t data)
 		this->setPower(1);
 
 	this->digitalWrite(this->pinWriterOut,0); // startbit
-  usleep(SYMBOL_TIME);
+  this->delay(this->symbolTime);
   for (uint8_t zz=0;zz<5;zz++)
   {
     this->digitalWrite(this->pinWriterOut,shift&0x01);
     shift>>=1;
-    usleep(SYMBOL_TIME);
+    this->delay(this->symbolTime);
   }
   this->digitalWrite(this->pinWriterOut,1); // stopbit
-	if ((data==BAUDOT_ALPHABET_1)||(data==BAUDOT_ALPHABET_2))
-		usleep(SYMBOL_TIME*5); // allow for some extra time to perform mechanical alphabet switch
-	else
-		usleep(SYMBOL_TIME*1.5); // TODO: tweak this for optimum speed ... 1.5 stopbits?
+	this->delay(this->getStopTime(data));
 
 
 	this->printBaudotChar(data);
@@ -389,6 +538,142 @@ void telex::sendRawChar(uint8_t data)
 	this->setPowerTimout();
 }
 
+uint8_t telex::setBaudrate(const char *baudrate)
+{
+	for (uint8_t zz=0;zz<TELEX_BAUD_PROFILES;zz++)
+	{
+		if (!strcmp(baudProfiles[zz].name,baudrate))
+		{
+			this->symbolTime=baudProfiles[zz].symbolTime;
+			this->stopTime=this->symbolTime*3/2;
+			return 1;
+		}
+	}
+	return 0;
+}
+
+const char *telex::getBaudrate(void)
+{
+	for (uint8_t zz=0;zz<TELEX_BAUD_PROFILES;zz++)
+		if (baudProfiles[zz].symbolTime==this->symbolTime)
+			return baudProfiles[zz].name;
+	return "custom";
+}
+
+uint8_t telex::sendRawCharLoopback(uint8_t data)
+{
+	// send one symbol and sample the keyboard input (local echo loopback) in the middle of every bit
+	// returns 1 if the echoed frame matches the symbol that was sent
+	uint8_t shift=data;
+	uint8_t echo=0;
+	uint8_t valid;
+	if (!this->getPower())
+		this->setPower(1);
+
+	this->digitalWrite(this->pinWriterOut,0); // startbit
+	this->delay(this->symbolTime/2);
+	valid=this->digitalRead(this->pinKeyboardIn); // startbit must be echoed (input is inverted)
+	this->delay(this->symbolTime/2);
+	for (uint8_t zz=0;zz<5;zz++)
+	{
+		this->digitalWrite(this->pinWriterOut,shift&0x01);
+		shift>>=1;
+		this->delay(this->symbolTime/2);
+		if (!this->digitalRead(this->pinKeyboardIn)) echo|=(1<<zz);
+		this->delay(this->symbolTime/2);
+	}
+	this->digitalWrite(this->pinWriterOut,1); // stopbit
+	this->delay(this->symbolTime/2);
+	valid&=!this->digitalRead(this->pinKeyboardIn); // stopbit must be echoed as well
+	unsigned long stopTime=this->getStopTime(data);
+	this->delay((stopTime>this->symbolTime/2)?stopTime-this->symbolTime/2:0);
+	this->updateState(data);
+	this->setPowerTimout();
+	return (valid&&(echo==data));
+}
+
+unsigned long telex::calibrateStopTime(void)
+{
+	// print the test pattern with shorter and shorter stop times until the loopback shows errors
+	// the shortest reliable stop time (plus one step of margin) is kept in stopTime and returned
+	unsigned long nominal=this->symbolTime*3/2;
+	unsigned long step=this->symbolTime/CALIBRATION_STEP_DIVIDER;
+	unsigned long best=nominal;
+	uint8_t symbols[TELEX_MAX_SYMBOLS_PER_CHAR];
+	const char *pattern=CALIBRATION_PATTERN;
+
+	// the echo of the stopbit is sampled half way, so stop times below half a bit can not be verified
+	for (unsigned long candidate=nominal;candidate>=this->symbolTime/2;candidate-=step)
+	{
+		uint8_t errors=0;
+
+		this->stopTime=nominal; // line feed and alphabet switch are never sent with a candidate stop time
+		this->sendChar('\n');
+		this->stopTime=candidate;
+		for (uint8_t zz=0;pattern[zz];zz++)
+		{
+			uint8_t count=planChar(pattern[zz],1,this->currentAlphabet,this->cursorPos,symbols);
+			for (uint8_t yy=0;yy<count;yy++)
+				if (!this->sendRawCharLoopback(symbols[yy]))
+					errors++;
+		}
+		telexLog(TELEX_LOG_INFO,TELEX_LOG_GENERAL,"[Calibrate stop time %ld us: %d errors]\n",candidate,errors);
+		if (errors) break;
+		best=candidate;
+	}
+
+	this->stopTime=(best+step<nominal)?best+step:nominal;
+	this->sendChar('\n');
+	telexLog(TELEX_LOG_INFO,TELEX_LOG_GENERAL,"[Calibrated stop time %ld us at %s bd]\n",this->stopTime,this->getBaudrate());
+	return this->stopTime;
+}
+
+uint8_t telex::loadCalibration(const char *path)
+{
+	// calibration file: one "<baudrate> <stop time in micro seconds>" line per baud profile
+	FILE *f=fopen(path,"r");
+	char baudrate[16];
+	unsigned long stopTime;
+	uint8_t found=0;
+
+	if (!f) return 0;
+	while (fscanf(f,"%15s %lu",baudrate,&stopTime)==2)
+	{
+		if ((!strcmp(baudrate,this->getBaudrate()))&&(stopTime))
+		{
+			this->stopTime=stopTime;
+			found=1;
+		}
+	}
+	fclose(f);
+	return found;
+}
+
+uint8_t telex::saveCalibration(const char *path)
+{
+	// replaces the line for the current baud profile, keeps the others
+	char lines[TELEX_BAUD_PROFILES][32];
+	uint8_t count=0;
+	char baudrate[16];
+	unsigned long stopTime;
+
+	FILE *f=fopen(path,"r");
+	if (f)
+	{
+		while ((count<TELEX_BAUD_PROFILES)&&(fscanf(f,"%15s %lu",baudrate,&stopTime)==2))
+			if (strcmp(baudrate,this->getBaudrate()))
+				snprintf(lines[count++],sizeof(lines[0]),"%s %lu\n",baudrate,stopTime);
+		fclose(f);
+	}
+
+	if (!(f=fopen(path,"w"))) return 0;
+	for (uint8_t zz=0;zz<count;zz++)
+		fputs(lines[zz],f);
+	fprintf(f,"%s %lu\n",this->getBaudrate(),this->stopTime);
+	fclose(f);
+	return 1;
+}
+
 uint8_t telex::detectStartBit(void)
 {
 	if (!this->getPower())
@@ -401,9 +686,9 @@ uint8_t telex::receiveRawChar(uint8_t localEcho)
 	// first call function detect startbit before calling this function
 	uint8_t data=0;
 
-  usleep(SYMBOL_TIME/2); // wait until we are half way into the start bit
+  this->delay(this->symbolTime/2); // wait until we are half way into the start bit
   if (localEcho) this->digitalWrite(this->pinWriterOut,0);
-  usleep(SYMBOL_TIME);
+  this->delay(this->symbolTime);
   for (uint8_t zz=0;zz<5;zz++)
   {
     if (!this->digitalRead(this->pinKeyboardIn))
@@ -418,78 +703,221 @@ uint8_t telex::receiveRawChar(uint8_t localEcho)
 				this->digitalWrite(this->pinWriterOut,0);
     }
     data>>=1;
-    usleep(SYMBOL_TIME);
+    this->delay(this->symbolTime);
   }
   if (localEcho)
 	{
 		this->digitalWrite(this->pinWriterOut,1);
 		this->updateState(data);
 	}
-  usleep(SYMBOL_TIME/2+1000); // wait until we are finished with the last bit to avoid detecting false startbit
+  this->delay(this->symbolTime/2+1000); // wait until we are finished with the last bit to avoid detecting false startbit
 	this->setPowerTimout();
 	this->printBaudotChar(data);
 	return data;
 }
 
-void telex::sendChar(uint8_t data, uint8_t filter)
+uint8_t telex::filterChar(uint8_t data, uint8_t filter)
 {
-	switch(filter) // first filter off illegal characters
+	switch(filter) // filter off illegal characters
 	{
 		case 4:
 			if ((data=='!')||(data=='#')||(data=='&')) // filter off national characters
 				data='+';
+			// fall through
 		case 3:
 			if (data=='%') // filter off bell character
 				data='+';
+			// fall through
 		case 2:
 			if (data=='*') // filter off null character
 				data='+';
+			// fall through
 		case 1:
 			if ((data=='~')||(data=='^')||(data=='$')) // filter off char/digit switch (~), digit/char switch (^) and WRU - who are you ($)
 				data='+';
+			// fall through
 		default:
 			break;
 	}
+	return data;
+}
+
+uint8_t telex::planChar(uint8_t data, uint8_t filter, uint8_t currentAlphabet, uint8_t cursorPos, uint8_t *symbols)
+{
+	// works out the raw symbols needed to print one character from the given telex state
+	// symbols must hold TELEX_MAX_SYMBOLS_PER_CHAR entries, function returns the number of symbols
+	uint8_t count=0;
 
-	uint8_t alphabet=this->encodeBaudotChar(&data);
+	data=filterChar(data,filter);
+	uint8_t alphabet=encodeBaudotChar(&data,currentAlphabet);
 
 	if (data==BAUDOT_CR)
-	{
-		//printf("Ignoring <CR>\n");
-		return; // ignore <CR>, as it is added to <LF> automatically
-	}
+		return 0; // ignore <CR>, as it is added to <LF> automatically
 	if (data==BAUDOT_LF)
 	{
-		printf("[Translating <LF> to <CR><LF>]\n");
-		this->sendRawChar(BAUDOT_CR); // insert <CR> before every <LF>
-		this->sendRawChar(BAUDOT_LF);
-		return;
+		symbols[count++]=BAUDOT_CR; // insert <CR> before every <LF>
+		symbols[count++]=BAUDOT_LF;
+		return count;
 	}
-	if ((this->isBaudotPrintChar(data))&&(this->cursorPos>=69)) // 69 characters per line, automatically insert CR and LF on line end
+	if ((isBaudotPrintChar(data))&&(cursorPos>=TELEX_LINE_WIDTH)) // automatically insert CR and LF on line end
 	{
-		printf("[Inserting extra <CR><LF>]\n");
-		this->sendRawChar(BAUDOT_CR); // insert <CR> before every <LF>
-		this->sendRawChar(BAUDOT_LF);
+		symbols[count++]=BAUDOT_CR;
+		symbols[count++]=BAUDOT_LF;
 	}
-	if (alphabet!=this->currentAlphabet)
+	if (alphabet!=currentAlphabet)
   {
-		this->sendRawChar(BAUDOT_NULL);
-		this->sendRawChar((alphabet==1)?BAUDOT_ALPHABET_1:BAUDOT_ALPHABET_2);
-		this->sendRawChar((alphabet==1)?BAUDOT_ALPHABET_1:BAUDOT_ALPHABET_2);
-    this->currentAlphabet=alphabet;
+		symbols[count++]=BAUDOT_NULL;
+		symbols[count++]=(alphabet==1)?BAUDOT_ALPHABET_1:BAUDOT_ALPHABET_2;
+		symbols[count++]=(alphabet==1)?BAUDOT_ALPHABET_1:BAUDOT_ALPHABET_2;
   }
-  this->sendRawChar(data);
+  symbols[count++]=data;
+	return count;
+}
+
+unsigned long telex::estimateSymbols(const uint8_t *data, uint8_t filter, uint8_t *currentAlphabet, uint8_t *cursorPos, unsigned long *returnColumns)
+{
+	// dry run of sendString: counts raw symbols and optionally adds the carriage return travel (in columns)
+	uint8_t symbols[TELEX_MAX_SYMBOLS_PER_CHAR];
+	unsigned long total=0;
+
+	for (size_t zz=0;data[zz];zz++)
+	{
+		uint8_t count=planChar(data[zz],filter,*currentAlphabet,*cursorPos,symbols);
+		for (uint8_t yy=0;yy<count;yy++)
+		{
+			if ((returnColumns)&&(symbols[yy]==BAUDOT_CR))
+				*returnColumns+=*cursorPos;
+			updateState(symbols[yy],currentAlphabet,cursorPos);
+		}
+		total+=count;
+	}
+	return total;
+}
+
+size_t telex::unpackSymbols(const uint8_t *data, size_t length, uint8_t *symbols)
+{
+	// symbols needs room for length*8/5 entries, returns the number of symbols
+	size_t count=0;
+	uint32_t bits=0;
+	uint8_t available=0;
+
+	for (size_t zz=0;zz<length;zz++)
+	{
+		bits=(bits<<8)|data[zz];
+		available+=8;
+		while (available>=5)
+		{
+			available-=5;
+			symbols[count++]=(bits>>available)&0x1f;
+		}
+	}
+	// the last group is padded with 0 bits: a <NULL> that only exists because of the padding
+	// (the symbols before it already fill all bytes) is not sent
+	if ((count)&&(!symbols[count-1])&&(((count-1)*5+7)/8==length))
+		count--;
+	return count;
+}
+
+uint8_t telex::checkSymbols(const uint8_t *symbols, size_t count, uint8_t *currentAlphabet, uint8_t *cursorPos)
+{
+	// a symbol stream may shift as it likes but must not run past the end of the line,
+	// the carriage would print over the last column
+	for (size_t zz=0;zz<count;zz++)
+	{
+		if (symbols[zz]>0x1f) return 0;
+		updateState(symbols[zz],currentAlphabet,cursorPos);
+		if (*cursorPos>TELEX_LINE_WIDTH) return 0;
+	}
+	return 1;
+}
+
+void telex::sendChar(uint8_t data, uint8_t filter)
+{
+	uint8_t symbols[TELEX_MAX_SYMBOLS_PER_CHAR];
+	uint8_t count=planChar(data,filter,this->currentAlphabet,this->cursorPos,symbols);
+
+	if ((count>1)&&(symbols[0]==BAUDOT_CR))
+		telexLog(TELEX_LOG_DEBUG,TELEX_LOG_LAYOUT,"[Inserting <CR><LF>]\n");
+	for (uint8_t zz=0;zz<count;zz++)
+		this->sendRawChar(symbols[zz]);
 }
 
 void telex::sendString(uint8_t *data, uint8_t filter)
 {
-  uint16_t zz=0;
+  size_t zz=0;
   while(data[zz])
   {
-		this->sendChar(data[zz],filter);
-    zz++;
+		if (data[zz]<0x80)
+		{
+			this->sendChar(data[zz],filter);
+			zz++;
+			continue;
+		}
+
+		// UTF-8 sequence: print the transliteration instead of a placeholder per byte
+		uint8_t len;
+		const char *ascii=ita2Transliterate(utf8Decode(data+zz,&len));
+		if (ascii)
+		{
+			while(*ascii)
+				this->sendChar(*ascii++,filter);
+		}
+		else
+			this->sendChar(TRANSLIT_PLACEHOLDER,filter);
+    zz+=len;
   }
-	printf("\n");
+	telexLog(TELEX_LOG_INFO,TELEX_LOG_ECHO,"\n");
+}
+
+void telex::restoreState(uint8_t alphabet, uint8_t cursorPos)
+{
+	// bring carriage and alphabet back to a saved state, e.g. when a preempted job resumes
+	if (this->cursorPos!=cursorPos)
+	{
+		if (this->cursorPos)
+		{
+			this->sendRawChar(BAUDOT_CR);
+			this->sendRawChar(BAUDOT_LF);
+		}
+		while (this->cursorPos<cursorPos)
+			this->sendRawChar(BAUDOT_SPACE); // same code in both alphabets
+	}
+	if ((alphabet)&&(alphabet!=this->currentAlphabet))
+	{
+		this->sendRawChar(BAUDOT_NULL);
+		this->sendRawChar((alphabet==1)?BAUDOT_ALPHABET_1:BAUDOT_ALPHABET_2);
+		this->sendRawChar((alphabet==1)?BAUDOT_ALPHABET_1:BAUDOT_ALPHABET_2);
+	}
+}
+
+void telex::sendMessage(const uint8_t *data, uint8_t filter, telexLayoutStats *stats)
+{
+	// print a complete message: transliterate, word wrap and end on a fresh line
+	telexLayoutStats localStats;
+	std::string text,layout;
+	uint8_t alphabet,cursorPos;
+
+	if (!stats) stats=&localStats;
+	ita2TransliterateString(data,text);
+	telexLayout(text,layout,this->cursorPos);
+
+	// compare with printing the raw text with hard line breaks followed by a newline
+	alphabet=this->currentAlphabet;
+	cursorPos=this->cursorPos;
+	stats->returnColumnsBefore=0;
+	stats->symbolsBefore=estimateSymbols((const uint8_t*)text.c_str(),filter,&alphabet,&cursorPos,&stats->returnColumnsBefore);
+	stats->symbolsBefore+=estimateSymbols((const uint8_t*)"\n",filter,&alphabet,&cursorPos,&stats->returnColumnsBefore);
+	alphabet=this->currentAlphabet;
+	cursorPos=this->cursorPos;
+	stats->returnColumnsAfter=0;
+	stats->symbolsAfter=estimateSymbols((const uint8_t*)layout.c_str(),filter,&alphabet,&cursorPos,&stats->returnColumnsAfter);
+	stats->timeSaved=(stats->symbolsBefore>stats->symbolsAfter)?(stats->symbolsBefore-stats->symbolsAfter)*(this->symbolTime*6+this->stopTime)/1000:0;
+	if (stats->returnColumnsBefore>stats->returnColumnsAfter)
+		stats->timeSaved+=(stats->returnColumnsBefore-stats->returnColumnsAfter)*CR_RETURN_TIME_PER_COLUMN/1000;
+
+	telexLog(TELEX_LOG_INFO,TELEX_LOG_LAYOUT,"[Layout saves %ld symbols and %ld columns carriage return (~%ld ms)]\n",
+		(long)stats->symbolsBefore-(long)stats->symbolsAfter,(long)stats->returnColumnsBefore-(long)stats->returnColumnsAfter,stats->timeSaved);
+	this->sendString((uint8_t*)layout.c_str(),filter);
 }
 
 uint8_t telex::receiveChar(uint8_t localEcho)
@@ -2,9 +2,44 @@
 #define TELEX_H
 
 #include <exception>
+#include <stddef.h>
 #include <stdint.h>
 #include <time.h>
 
+// characters per line, a <CR><LF> is inserted automatically when a line is full
+#define TELEX_LINE_WIDTH 69
+// most raw symbols sendChar needs for one character: <CR><LF> <NULL><ALPHABET><ALPHABET> char
+#define TELEX_MAX_SYMBOLS_PER_CHAR 6
+
+// runtime selectable baud rates (see telex::setBaudrate)
+#define TELEX_BAUD_PROFILES 4
+// stop time per baud rate as found by telex::calibrateStopTime
+#define TELEX_CALIBRATION_FILE "/etc/telex.cal"
+
+struct telexBaudProfile
+{
+	const char *name; // baud rate as given on the commandline
+	unsigned long symbolTime; // micro seconds
+};
+
+// message priorities, a higher priority job preempts a lower one at the next line boundary
+#define TELEX_PRIORITIES 4
+#define TELEX_PRIORITY_NORMAL 0
+#define TELEX_PRIORITY_ALERT 2
+
+// message formats: UTF-8 text, or ITA2 symbols sent as they are (see telex::unpackSymbols)
+#define TELEX_FORMAT_TEXT 0
+#define TELEX_FORMAT_ITA2 1
+// packed ITA2: 8 symbols of 5 bits in 5 bytes, the first symbol in the top bits of the first byte
+#define TELEX_PACKED_GROUP_BYTES 5
+#define TELEX_PACKED_GROUP_SYMBOLS 8
+
+// registers kept in memory for the simulated (no hardware) mode, covers GPIO_SET, GPIO_CLR and GPIO_GET
+#define TELEX_SIM_REGISTERS 16
+
+struct telexLayoutStats;
+class telexCapture;
+
 class telexMemoryException: public std::exception
 {
 	virtual const char* what() const throw()
@@ -26,6 +61,7 @@ class telex
 	private:
 		volatile unsigned *gpio;
 		unsigned ioPinMask;
+		unsigned simulatedGpio[TELEX_SIM_REGISTERS];
 
 	public:
 		uint8_t pinWriterOut;
@@ -35,16 +71,32 @@ class telex
 
 		static const uint8_t alphabet1[32];
 		static const uint8_t alphabet2[32];
+		static const telexBaudProfile baudProfiles[TELEX_BAUD_PROFILES];
+
+		unsigned long symbolTime; // micro seconds per bit
+		unsigned long stopTime; // micro seconds of stop bit after a normal symbol
 
 		time_t powerState;
 		uint8_t powerTimeout;
 		uint8_t currentAlphabet;
 		uint8_t cursorPos;
 
+		uint8_t simulate; // no hardware access, delays are only added to simulatedTime
+		unsigned long long simulatedTime; // micro seconds
+
+		telexCapture *capture; // GPIO capture, 0 when disabled
+
 	public:
-		telex(uint8_t pinWriterOut=17, uint8_t pinKeyboardIn=18, uint8_t pinPowerControl=27, uint8_t pinColorControl=23, uint8_t legacyIOMapping=0, uint8_t powerTimout=10);
+		telex(uint8_t pinWriterOut=17, uint8_t pinKeyboardIn=18, uint8_t pinPowerControl=27, uint8_t pinColorControl=23, uint8_t legacyIOMapping=0, uint8_t powerTimout=10, uint8_t simulate=0);
+		~telex(); // unmaps the GPIO registers, the pins keep their level
+		void delay(unsigned long us);
+		void enableCapture(size_t events);
+		uint8_t writeCapture(const char *path);
+		uint64_t getTimestamp(void);
 		unsigned pin2Mask(uint8_t pin);
 		void digitalWrite(uint8_t pin, uint8_t value, uint8_t filter=1);
+		void writeMask(unsigned setMask, unsigned clearMask);
+		void setOutput(uint8_t pin);
 		uint8_t digitalRead(uint8_t pin);
 		void setColor(uint8_t redBlack=0);
 		void setPower(uint8_t onOff);
@@ -52,16 +104,35 @@ class telex
 		void setPowerTimout(void);
 		uint8_t checkPowerTimeout(void);
 		uint8_t getBaudotAlphabet(uint8_t *data);
+		static uint8_t getBaudotAlphabet(uint8_t *data, uint8_t currentAlphabet);
 		uint8_t encodeBaudotChar(uint8_t *data);
+		static uint8_t encodeBaudotChar(uint8_t *data, uint8_t currentAlphabet);
 		uint8_t decodeBaudotChar(uint8_t data);
-		uint8_t isBaudotPrintChar(uint8_t data);
+		static uint8_t isBaudotPrintChar(uint8_t data);
 		void printBaudotChar(uint8_t data);
 		void updateState(uint8_t data);
+		static void updateState(uint8_t data, uint8_t *currentAlphabet, uint8_t *cursorPos);
+		static uint8_t filterChar(uint8_t data, uint8_t filter);
+		static uint8_t planChar(uint8_t data, uint8_t filter, uint8_t currentAlphabet, uint8_t cursorPos, uint8_t *symbols);
+		static unsigned long estimateSymbols(const uint8_t *data, uint8_t filter, uint8_t *currentAlphabet, uint8_t *cursorPos, unsigned long *returnColumns=0);
+		static size_t unpackSymbols(const uint8_t *data, size_t length, uint8_t *symbols);
+		static uint8_t checkSymbols(const uint8_t *symbols, size_t count, uint8_t *currentAlphabet, uint8_t *cursorPos);
+		uint8_t setBaudrate(const char *baudrate);
+		const char *getBaudrate(void);
+		unsigned long getReturnSettleTime(uint8_t column);
+		unsigned long getStopTime(uint8_t data);
+		unsigned long getStopTime(uint8_t data, uint8_t column);
 		void sendRawChar(uint8_t data);
+		uint8_t sendRawCharLoopback(uint8_t data);
+		unsigned long calibrateStopTime(void);
+		uint8_t loadCalibration(const char *path);
+		uint8_t saveCalibration(const char *path);
 		uint8_t detectStartBit(void);
 		uint8_t receiveRawChar(uint8_t localEcho=1);
 		void sendChar(uint8_t data, uint8_t filter=1);
 		void sendString(uint8_t *data, uint8_t filter=1);
+		void restoreState(uint8_t alphabet, uint8_t cursorPos);
+		void sendMessage(const uint8_t *data, uint8_t filter=1, telexLayoutStats *stats=0);
 		uint8_t receiveChar(uint8_t localEcho=1);
 };
 #endif
@@ -0,0 +1,157 @@
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include "telexBank.h"
+#include "telexTranslit.h"
+#include "telexCapture.h"
+#include "telexLog.h"
+
+telexBank::telexBank(telex *t)
+{
+	this->t=t;
+	this->count=0;
+	this->tickTime=t->symbolTime*1000ULL/TELEX_BANK_TICKS_PER_BIT; // again in run, the baud rate may change
+	this->ticks=0;
+	this->sent=0;
+}
+
+int telexBank::addLine(uint8_t pin)
+{
+	if ((this->count>=TELEX_BANK_LINES)||(pin>=32)) return -1;
+	for (uint8_t zz=0;zz<this->count;zz++)
+		if (this->lines[zz].pin==pin) return -1;
+
+	telexBankLine *line=&this->lines[this->count];
+	line->pin=pin;
+	line->mask=this->t->pin2Mask(pin);
+	line->symbols.clear();
+	line->next=0;
+	line->currentAlphabet=0;
+	line->cursorPos=0;
+	line->sendAlphabet=0;
+	line->sendCursorPos=0;
+	line->code=0;
+	line->bit=TELEX_BANK_IDLE;
+	line->ticks=0;
+	line->stopTicks=0;
+	snprintf(line->name,sizeof(line->name),"line%d",this->count);
+
+	this->t->setOutput(pin);
+	this->t->writeMask(line->mask,0); // idle level
+	if (this->t->capture) this->t->capture->setPinName(pin,line->name);
+	return this->count++;
+}
+
+void telexBank::send(uint8_t line, const uint8_t *data, uint8_t filter)
+{
+	uint8_t symbols[TELEX_MAX_SYMBOLS_PER_CHAR];
+	std::string text;
+	if (line>=this->count) return;
+
+	telexBankLine *l=&this->lines[line];
+	if (l->next>=l->symbols.length())
+	{
+		l->symbols.clear();
+		l->next=0;
+	}
+	ita2TransliterateString(data,text);
+	l->symbols.reserve(l->symbols.length()+text.length()+text.length()/4);
+	for (size_t zz=0;zz<text.length();zz++)
+	{
+		uint8_t n=telex::planChar(text[zz],filter,l->currentAlphabet,l->cursorPos,symbols);
+		for (uint8_t yy=0;yy<n;yy++)
+		{
+			l->symbols+=(char)symbols[yy];
+			telex::updateState(symbols[yy],&l->currentAlphabet,&l->cursorPos);
+		}
+	}
+}
+
+uint8_t telexBank::advance(telexBankLine *line)
+{
+	// next bit of the line's frame, returns 0 when the line has nothing to send
+	if (line->bit==TELEX_BANK_STOP)
+		line->bit=TELEX_BANK_IDLE;
+	else if (line->bit!=TELEX_BANK_IDLE)
+	{
+		line->bit++;
+		line->ticks=(line->bit==TELEX_BANK_STOP)?line->stopTicks:TELEX_BANK_TICKS_PER_BIT;
+		return 1;
+	}
+
+	if (line->next>=line->symbols.length()) return 0;
+	line->code=line->symbols[line->next++];
+	// the stop time depends on the carriage position before the symbol (carriage return)
+	unsigned long long stop=this->t->getStopTime(line->code,line->sendCursorPos)*1000ULL;
+	line->stopTicks=(unsigned long)((stop+this->tickTime-1)/this->tickTime);
+	telex::updateState(line->code,&line->sendAlphabet,&line->sendCursorPos);
+	line->bit=TELEX_BANK_START;
+	line->ticks=TELEX_BANK_TICKS_PER_BIT;
+	this->sent++;
+	return 1;
+}
+
+uint8_t telexBank::tick(void)
+{
+	unsigned setMask=0, clearMask=0;
+	uint8_t busy=0;
+
+	for (uint8_t zz=0;zz<this->count;zz++)
+	{
+		telexBankLine *line=&this->lines[zz];
+		if ((!line->ticks)&&(!this->advance(line))) continue;
+		line->ticks--;
+		busy=1;
+
+		// start bit is space (0), data bits are sent as they are (LSB first), stop bit is mark (1)
+		uint8_t level=(line->bit==TELEX_BANK_START)?0:(line->bit==TELEX_BANK_STOP)?1:(line->code>>(line->bit-1))&1;
+		if (level) setMask|=line->mask;
+		else clearMask|=line->mask;
+	}
+	if (busy)
+	{
+		this->t->writeMask(setMask,clearMask);
+		this->ticks++;
+	}
+	return busy;
+}
+
+void telexBank::wait(uint64_t deadline)
+{
+	// absolute deadlines, so the time spent per tick does not add up over a frame
+	if (this->t->simulate)
+	{
+		this->t->delay((deadline-this->t->getTimestamp())/1000);
+		return;
+	}
+	struct timespec until;
+	until.tv_sec=deadline/1000000000ULL;
+	until.tv_nsec=deadline%1000000000ULL;
+	while (clock_nanosleep(CLOCK_MONOTONIC,TIMER_ABSTIME,&until,NULL)==EINTR);
+}
+
+void telexBank::run(void)
+{
+	if (!this->t->getPower())
+		this->t->setPower(1);
+
+	this->tickTime=this->t->symbolTime*1000ULL/TELEX_BANK_TICKS_PER_BIT;
+	unsigned long ticks=this->ticks, sent=this->sent;
+	uint64_t deadline=this->t->getTimestamp();
+	while (this->tick())
+	{
+		deadline+=this->tickTime;
+		this->wait(deadline);
+	}
+	this->t->setPowerTimout();
+	telexLog(TELEX_LOG_INFO,TELEX_LOG_GENERAL,"[Bank: %lu symbols on %d lines in %lu ticks]\n",this->sent-sent,this->count,this->ticks-ticks);
+}
+
+size_t telexBank::backlog(void)
+{
+	size_t symbols=0;
+	for (uint8_t zz=0;zz<this->count;zz++)
+		symbols+=this->lines[zz].symbols.length()-this->lines[zz].next;
+	return symbols;
+}
@@ -0,0 +1,66 @@
+#ifndef TELEX_BANK_H
+#define TELEX_BANK_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include "telex.h"
+
+// one line per GPIO of the set/clear registers
+#define TELEX_BANK_LINES 32
+// the bank runs on half bit ticks, so the 1.5 bit stop time is a whole number of ticks
+#define TELEX_BANK_TICKS_PER_BIT 2
+
+// frame position of a line: start bit, 5 data bits, stop bit, idle
+#define TELEX_BANK_START 0
+#define TELEX_BANK_STOP 6
+#define TELEX_BANK_IDLE 7
+
+struct telexBankLine
+{
+	uint8_t pin; // writer output
+	unsigned mask;
+	char name[8]; // capture signal name
+	std::string symbols; // planned raw symbols
+	size_t next; // next symbol to send
+	uint8_t currentAlphabet; // state after the planned symbols
+	uint8_t cursorPos;
+	uint8_t sendAlphabet; // state of the machine, up to the symbol being sent
+	uint8_t sendCursorPos;
+	uint8_t code; // symbol being sent
+	uint8_t bit; // frame position (TELEX_BANK_START...TELEX_BANK_IDLE)
+	unsigned long ticks; // ticks left of the current bit
+	unsigned long stopTicks; // length of the stop bit of the symbol being sent
+};
+
+// Transmits on several teleprinter lines in lockstep: every tick the level of all lines is
+// collected into one set and one clear mask and written with a single store per register,
+// so one timing loop drives any number of machines (power and baud rate are shared, the
+// power and color pins of the telex are used). Text is planned into raw symbols per line
+// beforehand (alphabet shifts, automatic <CR><LF> and stop times as telex::sendChar).
+class telexBank
+{
+	private:
+		telex *t;
+		telexBankLine lines[TELEX_BANK_LINES];
+		uint8_t count;
+		unsigned long long tickTime; // nano seconds
+
+	private:
+		uint8_t advance(telexBankLine *line);
+		void wait(uint64_t deadline);
+
+	public:
+		unsigned long ticks; // ticks transmitted
+		unsigned long sent; // symbols transmitted
+
+	public:
+		telexBank(telex *t);
+		int addLine(uint8_t pin); // returns the line number, -1 when the pin is taken or the bank is full
+		void send(uint8_t line, const uint8_t *data, uint8_t filter=1); // plans the text, run sends it
+		uint8_t tick(void); // writes the levels of one tick, returns 0 when all lines are idle
+		void run(void); // transmits until every line is idle
+		size_t backlog(void); // planned symbols not sent yet
+};
+
+#endif
@@ -0,0 +1,227 @@
+#include "telex.h"
+#include "telexLog.h"
+#include "telexQueue.h"
+#include "telexPrinter.h"
+#include "telexBank.h"
+#include "telexEnvelope.h"
+#include "telexFilter.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <string>
+
+// Microbenchmarks for the encode, decode and queue paths on a simulated telex (no GPIO access,
+// no delays). Every benchmark prints one JSON line so results of two builds can be compared:
+// {"name":"...","iterations":N,"ns_per_op":X,"simulated_us_per_op":Y}
+// simulated_us_per_op is the print time the telex itself would need (0 for non printing paths).
+
+// minimum run time per benchmark (nano seconds)
+#define BENCH_MIN_TIME 200000000ULL
+
+static const char *benchText=
+	"2018-01-31 10:37:09 UTC: hello from space, TTN! The quick brown fox jumps over the lazy dog 1234567890 "
+	"(+-,.:/=?) this line is long enough to wrap at least once on a 69 column telex.\n";
+
+static unsigned long long now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC,&ts);
+	return (unsigned long long)ts.tv_sec*1000000000ULL+ts.tv_nsec;
+}
+
+static volatile unsigned long benchSink; // keeps the compiler from optimizing the work away
+
+static void report(const char *name, unsigned long iterations, unsigned long long elapsed, double simulated)
+{
+	printf("{\"name\":\"%s\",\"iterations\":%lu,\"ns_per_op\":%.1f,\"simulated_us_per_op\":%.1f}\n",
+		name,iterations,(double)elapsed/iterations,simulated);
+	fflush(stdout);
+}
+
+// runs body in batches until BENCH_MIN_TIME has passed, body returns the work done per call
+#define BENCH(name, simulated, body) \
+	do { \
+		unsigned long iterations=0; \
+		unsigned long long start=now_ns(), elapsed; \
+		do { \
+			for (int batch=0;batch<64;batch++) { body; } \
+			iterations+=64; \
+			elapsed=now_ns()-start; \
+		} while (elapsed<BENCH_MIN_TIME); \
+		report(name,iterations,elapsed,simulated); \
+	} while (0)
+
+static void bench_encode(telex *t)
+{
+	uint8_t c=0x20;
+	BENCH("encodeBaudotChar",0,
+	{
+		uint8_t data=c;
+		benchSink+=t->encodeBaudotChar(&data)+data;
+		c=(c>=0x7e)?0x20:c+1;
+	});
+}
+
+static void bench_decode(telex *t)
+{
+	uint8_t c=0;
+	BENCH("decodeBaudotChar",0,
+	{
+		benchSink+=t->decodeBaudotChar(c);
+		c=(c+1)&0x1f;
+	});
+}
+
+static void bench_send_string(telex *t)
+{
+	unsigned long long simulatedStart=t->simulatedTime;
+	unsigned long calls=0;
+	BENCH("sendString",(double)(t->simulatedTime-simulatedStart)/(calls?calls:1),
+	{
+		t->sendString((uint8_t*)benchText);
+		calls++;
+	});
+}
+
+static void bench_print_run(telex *t)
+{
+	// a burst of short messages through the printer, they are printed as one run
+	static const char *burst="2018-01-31 10:37:09 UTC: node 42 battery 3.71 V";
+	telexPrinter printer(t);
+	size_t length=strlen(burst);
+	unsigned long long simulatedStart=t->simulatedTime;
+	unsigned long calls=0;
+	BENCH("print_run",(double)(t->simulatedTime-simulatedStart)/(calls?calls:1),
+	{
+		printer.submit(new telexPrintJob(burst,length));
+		calls++;
+		while (printer.backlog()>=TELEX_RUN_AHEAD) // as the print loop: the next message joins the run
+			printer.printLine();
+	});
+}
+
+static void bench_bank(telex *t, uint8_t lines, const char *name)
+{
+	// one tick of a bank: the cost should hardly grow with the number of lines
+	telexBank bank(t);
+	for (uint8_t zz=0;zz<lines;zz++)
+		bank.addLine(zz);
+	BENCH(name,0,
+	{
+		if (!bank.tick())
+			for (uint8_t zz=0;zz<lines;zz++)
+				bank.send(zz,(const uint8_t*)benchText);
+	});
+}
+
+static void bench_queue_backlog(void)
+{
+	telexQueue queue(1000);
+	std::string message;
+	size_t length=strlen(benchText);
+
+	for (int zz=0;zz<1000;zz++)
+		queue.push(benchText,length); // full backlog
+	BENCH("queue_push_pop_backlog",0,
+	{
+		queue.pop(message);
+		queue.push(benchText,length);
+		benchSink+=message.length();
+	});
+}
+
+static void bench_ingest(void)
+{
+	// synthetic payloads of different sizes against a small queue that keeps overflowing
+	telexQueue queue(10);
+	char payload[4096];
+	size_t sizes[]={16,64,200,1024,4000};
+	unsigned zz=0;
+
+	for (size_t yy=0;yy<sizeof(payload);yy++)
+		payload[yy]=benchText[yy%strlen(benchText)];
+	BENCH("ingest_payload",0,
+	{
+		size_t length=sizes[zz++%(sizeof(sizes)/sizeof(sizes[0]))];
+		telexLog(TELEX_LOG_INFO,TELEX_LOG_MQTT,"Received '%.*s'\n",(int)length,payload);
+		queue.push(payload,length);
+	});
+}
+
+static void bench_envelope(void)
+{
+	static const char *envelope="{\"pri\":1,\"ttl\":600,\"id\":\"sat-4711\",\"color\":\"red\","
+		"\"text\":\"2018-01-31 10:37:09 UTC: hello from space, TTN! The quick brown fox jumps over the lazy dog\"}";
+	size_t length=strlen(envelope);
+	telexEnvelope parsed;
+	BENCH("envelope_parse",0,
+	{
+		benchSink+=telexParseEnvelope(envelope,length,&parsed)+parsed.text.length;
+	});
+}
+
+static void bench_filter(void)
+{
+	// scan cost of a payload that passes a rule set of typical size unchanged
+	telexFilter filter;
+	std::string out;
+	uint8_t changed;
+	size_t length=strlen(benchText);
+	char pattern[32];
+
+	filter.addRule(TELEX_FILTER_DROP,"crc error");
+	for (int zz=0;zz<50;zz++)
+	{
+		snprintf(pattern,sizeof(pattern),"junk%d",zz);
+		filter.addRule(TELEX_FILTER_REWRITE,pattern,"");
+	}
+	filter.setMinPrintable(0.8);
+	BENCH("filter_apply",0,
+	{
+		benchSink+=filter.apply(benchText,length,out,&changed);
+	});
+}
+
+static void bench_unpack(void)
+{
+	// a packed ITA2 payload is unpacked and checked instead of transliterated and laid out
+	static const uint8_t group[TELEX_PACKED_GROUP_BYTES]={0x84,0x21,0x08,0x41,0x02}; // "tttttt" <CR><LF>
+	uint8_t packed[2500], symbols[4000];
+	uint8_t alphabet, cursorPos;
+	for (size_t zz=0;zz<sizeof(packed);zz++)
+		packed[zz]=group[zz%TELEX_PACKED_GROUP_BYTES];
+	BENCH("ita2_unpack",0,
+	{
+		alphabet=1;
+		cursorPos=0;
+		size_t count=telex::unpackSymbols(packed,sizeof(packed),symbols);
+		benchSink+=count+telex::checkSymbols(symbols,count,&alphabet,&cursorPos);
+	});
+}
+
+int main(int argc, char **argv)
+{
+	// logging is filtered at runtime, so the log calls on the measured paths cost what they cost in production
+	telexLogStart();
+	telexLogSetLevel(TELEX_LOG_ERROR);
+
+	telex *t=new telex(17,18,27,22,0,10,1);
+	t->setPower(1);
+
+	bench_encode(t);
+	bench_decode(t);
+	bench_send_string(t);
+	bench_print_run(t);
+	bench_bank(t,1,"bank_tick_1_line");
+	bench_bank(t,16,"bank_tick_16_lines");
+	bench_queue_backlog();
+	bench_ingest();
+	bench_envelope();
+	bench_filter();
+	bench_unpack();
+
+	telexLogStop();
+	return 0;
+}
@@ -0,0 +1,128 @@
+#include <stdio.h>
+#include <time.h>
+#include "telexCapture.h"
+
+// bits of a frame that are checked: start bit and 5 data bits
+#define CAPTURE_FRAME_BITS 6
+// a deviation of more than 1/CAPTURE_TOLERANCE of a bit is out of tolerance
+#define CAPTURE_TOLERANCE 10
+
+telexCapture::telexCapture(size_t capacity)
+{
+	size_t size=1;
+	while (size<capacity) size<<=1;
+	this->events=new telexCaptureEvent[size];
+	this->mask=size-1;
+	this->head=0;
+	for (uint8_t zz=0;zz<CAPTURE_PINS;zz++)
+		this->pinNames[zz]=0;
+}
+
+telexCapture::~telexCapture()
+{
+	delete[] this->events;
+}
+
+void telexCapture::setPinName(uint8_t pin, const char *name)
+{
+	if (pin<CAPTURE_PINS) this->pinNames[pin]=name;
+}
+
+size_t telexCapture::size(void)
+{
+	return (this->head>this->mask)?this->mask+1:this->head;
+}
+
+uint8_t telexCapture::writeVCD(const char *path)
+{
+	FILE *f=fopen(path,"w");
+	if (!f) return 0;
+
+	size_t count=this->size();
+	uint64_t first=this->head-count;
+	uint32_t usedPins=0;
+	for (uint64_t zz=first;zz<this->head;zz++)
+		usedPins|=1u<<(this->events[zz&this->mask].pin&(CAPTURE_PINS-1));
+
+	time_t now=time(NULL);
+	char date[32];
+	strftime(date,sizeof(date),"%Y/%m/%d %H:%M:%S",localtime(&now));
+	fprintf(f,"$date %s $end\n$version telex GPIO capture $end\n$timescale 1ns $end\n$scope module telex $end\n",date);
+	for (uint8_t pin=0;pin<CAPTURE_PINS;pin++)
+	{
+		if (!(usedPins&(1u<<pin))) continue;
+		if (this->pinNames[pin])
+			fprintf(f,"$var wire 1 %c %s $end\n",'!'+pin,this->pinNames[pin]);
+		else
+			fprintf(f,"$var wire 1 %c gpio%d $end\n",'!'+pin,pin);
+	}
+	fprintf(f,"$upscope $end\n$enddefinitions $end\n");
+
+	// only level changes are written, repeated samples of the same level add nothing to the waveform
+	uint8_t level[CAPTURE_PINS];
+	for (uint8_t pin=0;pin<CAPTURE_PINS;pin++) level[pin]=2; // unknown
+	uint64_t lastTime=~0ULL;
+	uint64_t start=count?this->events[first&this->mask].time:0;
+	for (uint64_t zz=first;zz<this->head;zz++)
+	{
+		const telexCaptureEvent *event=&this->events[zz&this->mask];
+		uint8_t pin=event->pin&(CAPTURE_PINS-1);
+		if (level[pin]==event->value) continue;
+		if (event->time!=lastTime)
+		{
+			fprintf(f,"#%llu\n",(unsigned long long)(event->time-start));
+			lastTime=event->time;
+		}
+		fprintf(f,"%d%c\n",event->value?1:0,'!'+pin);
+		level[pin]=event->value;
+	}
+	fclose(f);
+	return 1;
+}
+
+void telexCapture::getStats(uint8_t pin, unsigned long bitTime, telexCaptureStats *stats)
+{
+	// compares the time between level changes inside a frame (start bit and data bits) with the
+	// nearest multiple of a bit, bitTime in micro seconds. The stop bit is not checked, its length
+	// is the calibrated stop time (longer after a carriage return) and it runs into the idle line.
+	double bit=bitTime*1000.0;
+	double total=0;
+	uint64_t lastEdge=0, frameEnd=0;
+	uint8_t level=2; // unknown
+	uint8_t inFrame=0;
+
+	stats->intervals=0;
+	stats->meanDeviation=0;
+	stats->maxDeviation=0;
+	stats->outOfTolerance=0;
+
+	size_t count=this->size();
+	for (uint64_t zz=this->head-count;zz<this->head;zz++)
+	{
+		const telexCaptureEvent *event=&this->events[zz&this->mask];
+		if ((event->pin!=pin)||(event->value==level)) continue;
+		if ((inFrame)&&(event->time>frameEnd))
+			inFrame=0; // end of the stop bit
+		if (inFrame)
+		{
+			double interval=(double)(event->time-lastEdge);
+			double bits=(uint64_t)(interval/bit+0.5);
+			if (bits<1) bits=1;
+			double deviation=interval-bits*bit;
+			if (deviation<0) deviation=-deviation;
+			total+=deviation;
+			if (deviation>stats->maxDeviation) stats->maxDeviation=deviation;
+			if (deviation>bit/CAPTURE_TOLERANCE) stats->outOfTolerance++;
+			stats->intervals++;
+		}
+		else if ((level==1)&&(!event->value))
+		{
+			// start bit (idle is mark), the last data bit ends CAPTURE_FRAME_BITS later
+			inFrame=1;
+			frameEnd=event->time+(uint64_t)(bit*CAPTURE_FRAME_BITS+bit/CAPTURE_TOLERANCE);
+		}
+		level=event->value;
+		lastEdge=event->time;
+	}
+	if (stats->intervals) stats->meanDeviation=total/stats->intervals;
+}
@@ -0,0 +1,56 @@
+#ifndef TELEX_CAPTURE_H
+#define TELEX_CAPTURE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Capture of every GPIO write and read sample of a telex into a preallocated ring, the newest
+// events overwrite the oldest. The ring can be written out as a VCD file for waveform viewers.
+
+#define CAPTURE_WRITE 0
+#define CAPTURE_READ 1
+#define CAPTURE_PINS 32
+#define CAPTURE_DEFAULT_EVENTS (1<<18) // 4 MB
+
+struct telexCaptureEvent
+{
+	uint64_t time; // monotonic nano seconds
+	uint8_t pin;
+	uint8_t value;
+	uint8_t type; // CAPTURE_WRITE or CAPTURE_READ
+};
+
+struct telexCaptureStats
+{
+	unsigned long intervals; // intervals checked (between two edges inside a frame)
+	double meanDeviation; // nano seconds from the nearest whole bit
+	double maxDeviation; // nano seconds
+	unsigned long outOfTolerance; // intervals more than 10% of a bit off
+};
+
+class telexCapture
+{
+	private:
+		telexCaptureEvent *events;
+		size_t mask;
+		uint64_t head; // total number of events recorded
+		const char *pinNames[CAPTURE_PINS];
+
+	public:
+		telexCapture(size_t capacity); // rounded up to a power of 2
+		~telexCapture();
+		inline void record(uint64_t time, uint8_t pin, uint8_t value, uint8_t type)
+		{
+			telexCaptureEvent *event=&this->events[this->head++&this->mask];
+			event->time=time;
+			event->pin=pin;
+			event->value=value;
+			event->type=type;
+		}
+		void setPinName(uint8_t pin, const char *name);
+		size_t size(void);
+		uint8_t writeVCD(const char *path);
+		void getStats(uint8_t pin, unsigned long bitTime, telexCaptureStats *stats);
+};
+
+#endif
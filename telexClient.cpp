@@ -0,0 +1,103 @@
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "telexClient.h"
+
+uint8_t telexReadLine(int fd, char *line, size_t size)
+{
+	size_t length=0;
+	char c;
+
+	while (read(fd,&c,1)==1)
+	{
+		if (c=='\n')
+		{
+			line[length]=0;
+			return 1;
+		}
+		if (length+1<size) line[length++]=c;
+	}
+	line[length]=0;
+	return (length>0);
+}
+
+uint8_t telexWriteAll(int fd, const char *data, size_t length)
+{
+	while (length)
+	{
+		ssize_t written=write(fd,data,length);
+		if (written<=0) return 0;
+		data+=written;
+		length-=written;
+	}
+	return 1;
+}
+
+telexClient::telexClient()
+{
+	this->fd=-1;
+	this->reply[0]=0;
+}
+
+telexClient::~telexClient()
+{
+	this->close();
+}
+
+uint8_t telexClient::open(const char *path)
+{
+	struct sockaddr_un address;
+
+	this->close();
+	if (strlen(path)>=sizeof(address.sun_path)) return 0;
+	if ((this->fd=socket(AF_UNIX,SOCK_STREAM,0))<0) return 0;
+
+	memset(&address,0,sizeof(address));
+	address.sun_family=AF_UNIX;
+	strcpy(address.sun_path,path);
+	if (connect(this->fd,(struct sockaddr *)&address,sizeof(address))<0)
+	{
+		this->close();
+		return 0;
+	}
+	return 1;
+}
+
+void telexClient::close(void)
+{
+	if (this->fd>=0) ::close(this->fd);
+	this->fd=-1;
+}
+
+uint8_t telexClient::request(const char *header, const char *data, size_t length)
+{
+	if (this->fd<0) return 0;
+	if (!telexWriteAll(this->fd,header,strlen(header))) return 0;
+	return (length==0)||telexWriteAll(this->fd,data,length);
+}
+
+uint8_t telexClient::readLine(char *line, size_t size)
+{
+	if (this->fd<0) return 0;
+	return telexReadLine(this->fd,line,size);
+}
+
+uint8_t telexClient::print(const char *data, uint8_t filter)
+{
+	char header[TELEX_JOB_LINE_SIZE];
+	size_t length=strlen(data);
+
+	this->reply[0]=0;
+	snprintf(header,sizeof(header),"PRINT %d %lu\n",filter,(unsigned long)length);
+	if (!this->request(header,data,length)) return 0;
+	return (this->readLine(this->reply,sizeof(this->reply))&&(!strncmp(this->reply,"OK",2)));
+}
+
+uint8_t telexClient::power(uint8_t onOff)
+{
+	this->reply[0]=0;
+	if (!this->request(onOff?"POWER 1\n":"POWER 0\n")) return 0;
+	return (this->readLine(this->reply,sizeof(this->reply))&&(!strncmp(this->reply,"OK",2)));
+}
@@ -0,0 +1,42 @@
+#ifndef TELEX_CLIENT_H
+#define TELEX_CLIENT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Job API of the telex daemon (telexd) on a Unix domain socket, one job per connection.
+// Requests are a header line, optionally followed by <length> bytes of text:
+//   PRINT <filter> <length>       print text (queued, answered right away, refused when the queue is full)
+//   POWER <0|1>                   switch power (queued behind earlier print jobs)
+//   READ <number> <timeout> <echo> read from the keyboard, answered with "DATA <character code>" lines
+// Every job is answered with "OK ..." or "ERR <reason>" as the last line.
+#define TELEX_SOCKET_PATH "/run/telexd.sock"
+#define TELEX_JOB_MAX_LENGTH (1024*1024)
+#define TELEX_JOB_LINE_SIZE 128
+#define TELEX_QUEUE_FULL "ERR queue full" // print job refused, try again once the daemon caught up
+
+class telexClient
+{
+	private:
+		int fd;
+
+	public:
+		char reply[TELEX_JOB_LINE_SIZE]; // last answer of the daemon
+
+	public:
+		telexClient();
+		~telexClient();
+		uint8_t open(const char *path=TELEX_SOCKET_PATH);
+		void close(void);
+		uint8_t request(const char *header, const char *data=0, size_t length=0);
+		uint8_t readLine(char *line, size_t size);
+		uint8_t print(const char *data, uint8_t filter=1);
+		uint8_t power(uint8_t onOff);
+};
+
+// reads one line (without newline) from a socket, returns 0 on error or end of file
+uint8_t telexReadLine(int fd, char *line, size_t size);
+// writes all data to a socket, returns 0 on error
+uint8_t telexWriteAll(int fd, const char *data, size_t length);
+
+#endif
@@ -1,11 +1,28 @@
 #include "telex.h"
+#include "telexLog.h"
+#include "telexClient.h"
+#include "telexCapture.h"
+#include "telexBank.h"
+#include "telexRealtime.h"
+#include "telexTranslit.h"
+#include "telexLayout.h"
 #include <getopt.h>
+#include <errno.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include <time.h>
 #include <string.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sched.h>
+#include <string>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <chrono>
 
 static void print_usage(const char *prog)
 {
@@ -13,16 +30,28 @@ static void print_usage(const char *prog)
   printf("- writer output = GPIO17\n");
   printf("- keyboard input = GPIO18\n");
   printf("- power switch output = GPIO27\n");
-	printf("Usage: %s [-pfrsnetlh]\n", prog);
+	printf("Usage: %s [-pfirscJnetlBCvSVLRh]\n", prog);
 	puts("  -p --print print text on telex \"line 1|_line2|_\" ('%'=BELL,'|'=CR,'_'=NL,'*'=NULL) \n"
        "  -f --format print one line of text with timestamp header \"line of text to print on telex\" \n"
+       "  -i --input print a file (- for stdin) as it is read, the telex stays powered until the input ends\n"
+       "     or pauses longer than the timeout (tail -f log | telexCtrl -i - -t 60)\n"
        "  -r --read reads data from telex\n"
        "  -s --stop cut power to telex\n"
+       "  -c --calibrate find the shortest reliable stop time (needs local echo loopback) and store it in the calibration file\n"
+       "  -J --jitter measure the wakeup latency of the bit timing for this many seconds (use with -R to check real-time mode)\n"
 	     "  -n --number number of characters to read\n"
 	     "  -e --echo enable local echo\n"
 	     "  -t --timeout number of seconds to wait for next character (default 5 seconds)\n"
        "  -l --legacy use this option for enabling legacy IO-mapping (Rapberry Pi 1 and Zero)\n"
+       "  -B --baud baud rate: 45.45, 50 (default), 75 or 100\n"
+       "  -C --calfile calibration file (default " TELEX_CALIBRATION_FILE ")\n"
+       "  -v --verbosity log level 0=error 1=warning 2=info 3=debug 4=trace\n"
+       "  -S --socket job socket of the telex daemon (default " TELEX_SOCKET_PATH ")\n"
+       "  -V --vcd capture all GPIO activity and write it to this VCD file (not with telexd)\n"
+       "  -L --lines print on several telex lines at once, writer outputs as GPIO list \"17,5,6\" (not with telexd)\n"
+       "  -R --realtime real-time bit timing on this CPU core (-1: any core): SCHED_FIFO, locked memory (not with telexd)\n"
 		   "  -h --help display this message\n"
+       "When the telex daemon (telexd) is running, print, read and stop jobs are sent to the daemon.\n"
        "Hint: please be careful with the number of newlines as to save the paper");
 	exit(1);
 }
@@ -33,18 +62,35 @@ uint8_t legacy=0; // use legacy IO mapping (Raspberry Pi 1 & Zero)
 char *data;
 uint16_t number=0;
 uint8_t timeout=10;
+const char *baudrate="50";
+const char *calfile=TELEX_CALIBRATION_FILE;
+const char *socketPath=TELEX_SOCKET_PATH;
+const char *vcdfile=0;
+const char *lines=0;
+int realtime=-2; // CPU core of the timing thread, -2 = no real-time mode
+unsigned jitterTime=0; // seconds
 
 static void parse_opts(int argc, char *argv[])
 {
 	static const struct option lopts[] = {
 		{ "print",  required_argument, 0, 'p' },
     { "format",  required_argument, 0, 'f' },
+    { "input",  required_argument, 0, 'i' },
     { "read", no_argument, 0, 'r' },
     { "stop", no_argument, 0, 's' },
+    { "calibrate", no_argument, 0, 'c' },
+    { "jitter", required_argument, 0, 'J' },
 		{ "number", required_argument, 0, 'n' },
 		{ "echo", no_argument, 0, 'e' },
 		{ "timeout", required_argument, 0, 't' },
     { "legacy", no_argument, 0, 'l' },
+    { "baud", required_argument, 0, 'B' },
+    { "calfile", required_argument, 0, 'C' },
+    { "verbosity", required_argument, 0, 'v' },
+    { "socket", required_argument, 0, 'S' },
+    { "vcd", required_argument, 0, 'V' },
+    { "lines", required_argument, 0, 'L' },
+    { "realtime", required_argument, 0, 'R' },
     { "help", no_argument, 0, 'h' },
 		{ NULL, 0, 0, 0 }
 	};
@@ -53,13 +99,13 @@ static void parse_opts(int argc, char *argv[])
 
 	while (1)
 	{
-		c = getopt_long(argc, argv, "p:f:rsn:et:lh", lopts, NULL);
+		c = getopt_long(argc, argv, "p:f:i:rscJ:n:et:lB:C:v:S:V:L:R:h", lopts, NULL);
 
 		if (c == -1)
 		{
 			if (mode==0)
 			{
-				printf("Invalid parameters: please specify operation mode (print, format, read, stop)\n");
+				printf("Invalid parameters: please specify operation mode (print, format, input, read, stop, calibrate, jitter)\n");
 				print_usage(argv[0]);
 			}
       if ((mode==3)&&((!timeout)&&(!number)))
@@ -76,7 +122,7 @@ static void parse_opts(int argc, char *argv[])
 			case 'p':
         if (mode)
         {
-          printf("Invalid parameters: only one mode specifier allowed (print, format, read, stop)\n");
+          printf("Invalid parameters: only one mode specifier allowed (print, format, input, read, stop, calibrate, jitter)\n");
           mode=0;
           break;
         }
@@ -86,17 +132,27 @@ static void parse_opts(int argc, char *argv[])
 			case 'f':
         if (mode)
         {
-          printf("Invalid parameters: only one mode specifier allowed (print, format, read, stop)\n");
+          printf("Invalid parameters: only one mode specifier allowed (print, format, input, read, stop, calibrate, jitter)\n");
           mode=0;
           break;
         }
 				mode=2;
 				data=optarg;
 				break;
+			case 'i':
+        if (mode)
+        {
+          printf("Invalid parameters: only one mode specifier allowed (print, format, input, read, stop, calibrate, jitter)\n");
+          mode=0;
+          break;
+        }
+				mode=7;
+				data=optarg;
+				break;
 			case 'r':
         if (mode)
         {
-          printf("Invalid parameters: only one mode specifier allowed (print, format, read, stop)\n");
+          printf("Invalid parameters: only one mode specifier allowed (print, format, input, read, stop, calibrate, jitter)\n");
           mode=0;
           break;
         }
@@ -105,12 +161,31 @@ static void parse_opts(int argc, char *argv[])
       case 's':
         if (mode)
         {
-          printf("Invalid parameters: only one mode specifier allowed (print, format, read, stop)\n");
+          printf("Invalid parameters: only one mode specifier allowed (print, format, input, read, stop, calibrate, jitter)\n");
           mode=0;
           break;
         }
 				mode=4;
 				break;
+      case 'c':
+        if (mode)
+        {
+          printf("Invalid parameters: only one mode specifier allowed (print, format, input, read, stop, calibrate, jitter)\n");
+          mode=0;
+          break;
+        }
+				mode=5;
+				break;
+      case 'J':
+        if (mode)
+        {
+          printf("Invalid parameters: only one mode specifier allowed (print, format, input, read, stop, calibrate, jitter)\n");
+          mode=0;
+          break;
+        }
+				mode=6;
+				jitterTime=abs(atoi(optarg));
+				break;
 			case 'n':
 				number=abs(atoi(optarg));
 				break;
@@ -123,6 +198,28 @@ static void parse_opts(int argc, char *argv[])
       case 'l':
 				legacy=1;
 				break;
+      case 'B':
+				baudrate=optarg;
+				break;
+      case 'C':
+				calfile=optarg;
+				break;
+      case 'v':
+				telexLogSetLevel(atoi(optarg));
+				break;
+      case 'S':
+				socketPath=optarg;
+				break;
+      case 'V':
+				vcdfile=optarg;
+				break;
+      case 'L':
+				lines=optarg;
+				break;
+      case 'R':
+				realtime=atoi(optarg);
+				if (realtime<0) realtime=-1;
+				break;
 			case 'h':
 			default:
 				print_usage(argv[0]);
@@ -130,14 +227,223 @@ static void parse_opts(int argc, char *argv[])
 	}
 }
 
+static int run_daemon_job(telexClient &client, const char *text, uint8_t filter)
+{
+	// hand the job to the telex daemon, the daemon keeps the printer powered between jobs
+	char line[TELEX_JOB_LINE_SIZE];
+
+	switch(mode)
+	{
+		case 1:
+		case 2:
+			if (!client.print(text,filter))
+			{
+				telexLog(TELEX_LOG_ERROR,TELEX_LOG_GENERAL,"Telex daemon did not accept print job\n");
+				return 1;
+			}
+			telexLog(TELEX_LOG_INFO,TELEX_LOG_GENERAL,"Print job queued on telex daemon\n");
+			break;
+		case 3:
+			snprintf(line,sizeof(line),"READ %d %d %d\n",number,timeout,echo);
+			if (!client.request(line)) return 1;
+			telexLog(TELEX_LOG_INFO,TELEX_LOG_GENERAL,"Listening for keyboard input\n");
+			while (client.readLine(line,sizeof(line)))
+			{
+				unsigned data;
+				if (!line[0])
+					continue;
+				if (sscanf(line,"DATA %u",&data)==1)
+				{
+					if (data=='\n')
+						telexLog(TELEX_LOG_INFO,TELEX_LOG_ECHO,"<LF>\n");
+					else if (data=='\r')
+						telexLog(TELEX_LOG_INFO,TELEX_LOG_ECHO,"<CR>\n");
+					else if (data<' ')
+						telexLog(TELEX_LOG_INFO,TELEX_LOG_ECHO,"<%u>\n",data);
+					else
+						telexLog(TELEX_LOG_INFO,TELEX_LOG_ECHO,"%c\n",data);
+				}
+				else
+				{
+					telexLog(TELEX_LOG_INFO,TELEX_LOG_GENERAL,"%s\n",line);
+					return strncmp(line,"OK",2)?1:0;
+				}
+			}
+			return 1;
+		case 4:
+			telexLog(TELEX_LOG_INFO,TELEX_LOG_GENERAL,"Cutting power to telex\n");
+			if (!client.power(0)) return 1;
+			break;
+	}
+	return 0;
+}
+
+// streaming print (-i): laid out lines waiting for the printer, the reader stays this far ahead
+#define STREAM_AHEAD_LINES 64
+// bytes of laid out text per print job when streaming to the telex daemon
+#define STREAM_JOB_SIZE 4096
+
+struct streamBuffer
+{
+	std::deque<std::string> lines;
+	bool eof;
+	telexRealtimeMutex lock; // the printing thread may run real-time
+	std::condition_variable_any changed;
+};
+
+static void read_stream(FILE *input, streamBuffer *buffer)
+{
+	// transliterate and lay out the input while the printer prints, one input line at a time
+	telexLayoutState layout;
+	std::string text, laidOut;
+	char *line=0;
+	size_t size=0;
+
+	telexLayoutInit(&layout);
+	while (getline(&line,&size,input)>=0)
+	{
+		ita2TransliterateString((const uint8_t*)line,text);
+		laidOut.clear();
+		telexLayoutAppend(text,laidOut,&layout);
+		for (size_t start=0,end;start<laidOut.length();start=end)
+		{
+			end=laidOut.find('\n',start);
+			end=(end==std::string::npos)?laidOut.length():end+1;
+			std::unique_lock<telexRealtimeMutex> guard(buffer->lock);
+			while (buffer->lines.size()>=STREAM_AHEAD_LINES)
+				buffer->changed.wait(guard);
+			buffer->lines.push_back(laidOut.substr(start,end-start));
+			buffer->changed.notify_all();
+		}
+	}
+	free(line);
+	laidOut.clear();
+	telexLayoutFinish(laidOut,&layout); // input that does not end with a newline
+	std::lock_guard<telexRealtimeMutex> guard(buffer->lock);
+	if (laidOut.length()) buffer->lines.push_back(laidOut);
+	buffer->eof=true;
+	buffer->changed.notify_all();
+}
+
+static void run_stream(telex *t, FILE *input)
+{
+	// the printer only waits for input when the input itself is slow, not for the layout
+	streamBuffer buffer;
+	buffer.eof=false;
+	std::thread reader(read_stream,input,&buffer);
+	unsigned long lines=0;
+	if (realtime>-2)
+	{
+		// the reader inherited the real-time priority of the printing thread, it must not compete with it
+		struct sched_param param;
+		memset(&param,0,sizeof(param));
+		pthread_setschedparam(reader.native_handle(),SCHED_OTHER,&param);
+	}
+
+	for (;;)
+	{
+		std::string line;
+		{
+			std::unique_lock<telexRealtimeMutex> guard(buffer.lock);
+			while ((buffer.lines.empty())&&(!buffer.eof))
+			{
+				// input pauses (e.g. a log tail): power stays on until the timeout expires
+				buffer.changed.wait_for(guard,std::chrono::seconds(1));
+				if (buffer.lines.empty())
+				{
+					guard.unlock();
+					t->checkPowerTimeout();
+					guard.lock();
+				}
+			}
+			if (buffer.lines.empty()) break;
+			line.swap(buffer.lines.front());
+			buffer.lines.pop_front();
+			buffer.changed.notify_all();
+		}
+		for (size_t zz=0;zz<line.length();zz++)
+			t->sendChar(line[zz]);
+		lines++;
+	}
+	reader.join();
+	telexLog(TELEX_LOG_INFO,TELEX_LOG_GENERAL,"Printed %lu lines\n",lines);
+}
+
+static size_t utf8_complete(const std::string &data)
+{
+	// length of data without a UTF-8 sequence cut off at its end
+	size_t start=data.length();
+	while ((start>0)&&(data.length()-start<3)&&(((uint8_t)data[start-1]&0xC0)==0x80))
+		start--;
+	if ((!start)||((uint8_t)data[start-1]<0xC0)) return data.length();
+	uint8_t lead=data[start-1];
+	size_t needed=(lead>=0xF0)?4:(lead>=0xE0)?3:2;
+	return (data.length()-(start-1)<needed)?start-1:data.length();
+}
+
+static int run_daemon_stream(FILE *input)
+{
+	// the input is laid out here, with the layout state carried from one print job to the next,
+	// and sent as one job per block as soon as the input pauses; the daemon keeps the printer
+	// powered between the jobs. The input is read with read(): poll does not see stdio buffers.
+	telexLayoutState layout;
+	std::string raw, text, job;
+	char chunk[STREAM_JOB_SIZE];
+	int fd=fileno(input);
+	bool eof=false;
+	int result=0;
+
+	telexLayoutInit(&layout);
+	while (!eof)
+	{
+		ssize_t length=read(fd,chunk,sizeof(chunk));
+		if ((length<0)&&(errno==EINTR)) continue;
+		if (length<=0) eof=true;
+		else raw.append(chunk,length);
+
+		struct pollfd more;
+		more.fd=fd;
+		more.events=POLLIN;
+		bool pause=(eof)||(poll(&more,1,0)<=0);
+		// whole input lines while more input is waiting, everything read so far when it pauses
+		size_t end=pause?utf8_complete(raw):raw.rfind('\n')+1;
+		if (end)
+		{
+			ita2TransliterateString((const uint8_t*)raw.substr(0,end).c_str(),text);
+			telexLayoutAppend(text,job,&layout);
+			raw.erase(0,end);
+		}
+		if (eof) telexLayoutFinish(job,&layout);
+		if ((job.empty())||((!pause)&&(job.length()<STREAM_JOB_SIZE)))
+			continue;
+
+		telexClient client;
+		while ((client.open(socketPath))&&(!client.print(job.c_str(),1))&&(!strcmp(client.reply,TELEX_QUEUE_FULL)))
+			sleep(1); // the daemon is busy with the earlier jobs
+		if (strncmp(client.reply,"OK",2))
+		{
+			telexLog(TELEX_LOG_ERROR,TELEX_LOG_GENERAL,"Telex daemon did not accept print job\n");
+			result=1;
+			break;
+		}
+		telexLog(TELEX_LOG_DEBUG,TELEX_LOG_GENERAL,"Print job of %lu bytes queued on telex daemon\n",(unsigned long)job.length());
+		job.clear();
+	}
+	return result;
+}
+
 int main(int argc, char **argv)
 {
 	parse_opts(argc, argv);
 
 	if (!mode) return 0;
 
-	telex *t=new telex(17,18,27,22,legacy,timeout);
+	telexLogStart();
+	atexit(telexLogStop);
 
+	char *text=data;
+	uint8_t filter=1;
+	char banner[150];
   switch(mode)
   {
     case 1:
@@ -149,8 +455,7 @@ int main(int argc, char **argv)
     			if (data[g]=='_') data[g]='\n';
     			g++;
     		}
-    		t->sendString((uint8_t*)data,0);
-        t->setPower(0);
+    		filter=0;
       }
       break;
     case 2:
@@ -171,33 +476,111 @@ int main(int argc, char **argv)
           g++;
         }
         if (!g) return 0; // nothing to print
-        char data2[150];
         time_t now = time(NULL);
-        strftime(data2,32,"+++ %Y/%m/%d %H:%M:%S +++\r\n= ",localtime(&now));
-        strcpy(data2+strlen(data2),data);
-        strcpy(data2+strlen(data2)," =\r\n%");//+++ end +++\r\n");
-    	  t->sendString((uint8_t*)data2);
-        t->setPower(0);
+        strftime(banner,32,"+++ %Y/%m/%d %H:%M:%S +++\r\n= ",localtime(&now));
+        strcpy(banner+strlen(banner),data);
+        strcpy(banner+strlen(banner)," =\r\n%");//+++ end +++\r\n");
+        text=banner;
+      }
+      break;
+  }
+
+	if (mode==6)
+	{
+		// wakeups on half bit deadlines, as telexBank, with a limit of 10% of a bit
+		unsigned long symbolTime=0;
+		for (uint8_t zz=0;zz<TELEX_BAUD_PROFILES;zz++)
+			if (!strcmp(telex::baudProfiles[zz].name,baudrate)) symbolTime=telex::baudProfiles[zz].symbolTime;
+		if (!symbolTime)
+		{
+			printf("Invalid parameters: unsupported baud rate %s\n",baudrate);
+			return 1;
+		}
+		if (realtime>-2) telexRealtimeStart(realtime);
+		telexJitterStats stats;
+		telexJitterTest(symbolTime/2,jitterTime*2000000UL/symbolTime,symbolTime/10,&stats);
+		printf("%lu wakeups every %lu us: latency mean %.1f us, worst %lu us, %lu later than %lu us\n",
+		       stats.samples,symbolTime/2,stats.meanLatency,stats.maxLatency,stats.late,symbolTime/10);
+		return stats.late?2:0;
+	}
+
+	FILE *input=0;
+	if (mode==7)
+	{
+		input=strcmp(data,"-")?fopen(data,"r"):stdin;
+		if (!input)
+		{
+			perror("Unable to open input");
+			return 1;
+		}
+	}
+
+	telexClient client;
+	if ((mode!=5)&&(!vcdfile)&&(!lines)&&(realtime==-2)&&(client.open(socketPath)))
+	{
+		if (mode!=7)
+			return run_daemon_job(client,text,filter);
+		client.close();
+		return run_daemon_stream(input);
+	}
+
+	telex *t=new telex(17,18,27,22,legacy,timeout);
+	if (!t->setBaudrate(baudrate))
+	{
+		printf("Invalid parameters: unsupported baud rate %s\n",baudrate);
+		return 1;
+	}
+	if ((mode!=5)&&(t->loadCalibration(calfile)))
+		telexLog(TELEX_LOG_INFO,TELEX_LOG_GENERAL,"Using calibrated stop time of %ld us\n",t->stopTime);
+	if (vcdfile)
+		t->enableCapture(CAPTURE_DEFAULT_EVENTS);
+	if (realtime>-2)
+		telexRealtimeStart(realtime);
+
+  switch(mode)
+  {
+    case 1:
+    case 2:
+      if (lines)
+      {
+        // the same text on every line, all lines are driven by one timing loop
+        telexBank bank(t);
+        std::string list(lines); // strtok_r writes into it, freed on every return
+        char *next=0;
+        for (char *pin=strtok_r(&list[0],",",&next);pin;pin=strtok_r(0,",",&next))
+        {
+          int line=bank.addLine(atoi(pin));
+          if (line<0)
+          {
+            printf("Invalid parameters: GPIO %s can not be a line\n",pin);
+            return 1;
+          }
+          bank.send(line,(uint8_t*)text,filter);
+        }
+        bank.run();
       }
+      else
+  		  t->sendString((uint8_t*)text,filter);
+      t->setPower(0);
       break;
     case 3:
       {
         int keyStrokeCounter=0;
-        printf("Listening for keyboard input\n");
+        telexLog(TELEX_LOG_INFO,TELEX_LOG_GENERAL,"Listening for keyboard input\n");
         do
         {
     			if (t->detectStartBit())
     			{
             keyStrokeCounter++;
             uint8_t data=t->receiveChar(echo);
-    				printf("%c\n",data);
+    				telexLog(TELEX_LOG_INFO,TELEX_LOG_ECHO,"%c\n",data);
     				if (data=='$')
     				  break;
     			}
     			usleep(100);
           if ((number)&&(keyStrokeCounter>=number))
           {
-            printf("Requested number (%d) of characters read from keyboard\n",number);
+            telexLog(TELEX_LOG_INFO,TELEX_LOG_GENERAL,"Requested number (%d) of characters read from keyboard\n",number);
             t->setPower(0);
           }
           t->checkPowerTimeout();
@@ -207,9 +590,25 @@ int main(int argc, char **argv)
       break;
     case 4:
       {
-        printf("Cutting power to telex\n");
+        telexLog(TELEX_LOG_INFO,TELEX_LOG_GENERAL,"Cutting power to telex\n");
+        t->setPower(0);
+      }
+      break;
+    case 7:
+      run_stream(t,input);
+      t->setPower(0);
+      break;
+    case 5:
+      {
+        telexLog(TELEX_LOG_INFO,TELEX_LOG_GENERAL,"Calibrating stop time at %s bd\n",baudrate);
+        t->calibrateStopTime();
+        if (!t->saveCalibration(calfile))
+          telexLog(TELEX_LOG_ERROR,TELEX_LOG_GENERAL,"Unable to write calibration file %s\n",calfile);
         t->setPower(0);
       }
       break;
 	}
+
+	if ((vcdfile)&&(!t->writeCapture(vcdfile)))
+		telexLog(TELEX_LOG_ERROR,TELEX_LOG_GENERAL,"Unable to write capture file %s\n",vcdfile);
 }
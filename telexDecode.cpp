@@ -0,0 +1,329 @@
+#include "telex.h"
+#include <getopt.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <vector>
+
+// Offline decoder for recorded telex lines: reconstructs Baudot frames, shift state and text from
+// raw bit samples or from a VCD capture (telexCtrl -V / telexmqtt -V) with the alphabet tables of
+// the telex class. Samples are kept packed 64 per word, the start bit search skips 64 idle samples
+// at a time and only the middle of each bit is sampled, so days of traffic decode in seconds.
+
+// samples per bit when a VCD capture is rendered into samples
+#define VCD_SAMPLES_PER_BIT 16
+
+static void print_usage(const char *prog)
+{
+	printf("Decodes recorded telex line samples offline.\n");
+	printf("Usage: %s [-frsIBtRh] file\n", prog);
+	puts("  -f --format input format: vcd (GPIO capture, default) or raw (packed bit samples, LSB first)\n"
+	     "  -r --rate sample rate of raw input in Hz\n"
+	     "  -s --signal VCD signal to decode (default keyboard_in, otherwise the first signal)\n"
+	     "  -I --idle idle level of the line 0 or 1 (default: the level at the end of the recording)\n"
+	     "  -B --baud baud rate: 45.45, 50 (default), 75 or 100\n"
+	     "  -t --timestamps start every line with the time (seconds) into the recording\n"
+	     "  -R --raw write every frame (time, code, character) instead of text\n"
+	     "  -h --help display this message");
+	exit(1);
+}
+
+const char *format="vcd";
+double rate=0;
+const char *signalName="keyboard_in";
+int lineIdle=-1;
+const char *baudrate="50";
+uint8_t timestamps=0;
+uint8_t rawFrames=0;
+
+static void parse_opts(int argc, char *argv[])
+{
+	static const struct option lopts[] = {
+		{ "format", required_argument, 0, 'f' },
+		{ "rate", required_argument, 0, 'r' },
+		{ "signal", required_argument, 0, 's' },
+		{ "idle", required_argument, 0, 'I' },
+		{ "baud", required_argument, 0, 'B' },
+		{ "timestamps", no_argument, 0, 't' },
+		{ "raw", no_argument, 0, 'R' },
+		{ "help", no_argument, 0, 'h' },
+		{ NULL, 0, 0, 0 }
+	};
+
+	int c;
+
+	while ((c=getopt_long(argc, argv, "f:r:s:I:B:tRh", lopts, NULL))!=-1)
+	{
+		switch (c)
+		{
+			case 'f':
+				format=optarg;
+				break;
+			case 'r':
+				rate=atof(optarg);
+				break;
+			case 's':
+				signalName=optarg;
+				break;
+			case 'I':
+				lineIdle=atoi(optarg)?1:0;
+				break;
+			case 'B':
+				baudrate=optarg;
+				break;
+			case 't':
+				timestamps=1;
+				break;
+			case 'R':
+				rawFrames=1;
+				break;
+			case 'h':
+			default:
+				print_usage(argv[0]);
+		}
+	}
+	if (optind!=argc-1)
+		print_usage(argv[0]);
+}
+
+// packed samples, sample i is bit i%64 of word i/64
+struct sampleBuffer
+{
+	std::vector<uint64_t> words;
+	uint64_t count;
+};
+
+static inline uint8_t sampleAt(const sampleBuffer &samples, uint64_t index)
+{
+	return (samples.words[index>>6]>>(index&63))&1;
+}
+
+static uint64_t findSample(const sampleBuffer &samples, uint64_t from, uint8_t value)
+{
+	// first sample at or after from with the given value (samples.count if none), 64 samples per step
+	uint64_t invert=value?0:~0ULL;
+	uint64_t word=from>>6;
+	if (from>=samples.count) return samples.count;
+
+	uint64_t bits=(samples.words[word]^invert)&(~0ULL<<(from&63));
+	while (!bits)
+	{
+		if (++word>=samples.words.size()) return samples.count;
+		bits=samples.words[word]^invert;
+	}
+	uint64_t index=(word<<6)+__builtin_ctzll(bits);
+	return (index<samples.count)?index:samples.count;
+}
+
+static uint8_t loadRaw(const char *path, sampleBuffer &samples)
+{
+	FILE *f=fopen(path,"rb");
+	if (!f) return 0;
+
+	uint64_t word;
+	size_t n;
+	samples.words.clear();
+	samples.count=0;
+	while ((n=fread(&word,1,sizeof(word),f))>0)
+	{
+		if (n<sizeof(word)) word&=(1ULL<<(n*8))-1;
+		samples.words.push_back(word);
+		samples.count=(uint64_t)samples.words.size()*64-(sizeof(word)-n)*8;
+	}
+	fclose(f);
+	return 1;
+}
+
+static void setSamples(sampleBuffer &samples, uint64_t from, uint64_t to, uint8_t level)
+{
+	// sets samples [from,to) to level, whole words at a time
+	if (!level) return; // buffer starts out all 0
+	for (;(from<to)&&(from&63);from++) samples.words[from>>6]|=1ULL<<(from&63);
+	for (;from+64<=to;from+=64) samples.words[from>>6]=~0ULL;
+	for (;from<to;from++) samples.words[from>>6]|=1ULL<<(from&63);
+}
+
+static uint8_t loadVCD(const char *path, double sampleRate, sampleBuffer &samples)
+{
+	// reads the level changes of one signal and renders them as samples
+	FILE *f=fopen(path,"r");
+	if (!f) return 0;
+
+	char line[256], id=0, firstId=0, name[128], unit[8];
+	double timescale=1e-9; // seconds per VCD time unit
+	int scale;
+	std::vector<std::pair<uint64_t,uint8_t> > changes;
+	uint64_t now=0;
+
+	while (fgets(line,sizeof(line),f))
+	{
+		if (line[0]=='#')
+			now=strtoull(line+1,NULL,10);
+		else if (((line[0]=='0')||(line[0]=='1'))&&(line[1]==id))
+			changes.push_back(std::make_pair(now,(uint8_t)(line[0]-'0')));
+		else if (sscanf(line,"$var wire 1 %c %127s",&firstId,name)==2)
+		{
+			if ((!id)||(!strcmp(name,signalName))) id=firstId;
+		}
+		else if (sscanf(line,"$timescale %d%7s",&scale,unit)==2)
+		{
+			double units[]={1,1e-3,1e-6,1e-9,1e-12};
+			const char *names[]={"s","ms","us","ns","ps"};
+			for (uint8_t zz=0;zz<5;zz++)
+				if (!strncmp(unit,names[zz],strlen(unit))) timescale=scale*units[zz];
+		}
+	}
+	fclose(f);
+	if ((!id)||(changes.empty())) return 0;
+
+	// the last level lasts a few bits more, so the stop bit of the last frame is in the samples
+	double samplesPerUnit=timescale*sampleRate;
+	samples.count=(uint64_t)(changes.back().first*samplesPerUnit)+8*VCD_SAMPLES_PER_BIT;
+	samples.words.assign((samples.count+63)/64,0);
+	// the level before the first change is not recorded, the line is assumed idle (as at the end)
+	setSamples(samples,0,(uint64_t)(changes.front().first*samplesPerUnit),changes.back().second);
+	for (size_t zz=0;zz<changes.size();zz++)
+	{
+		uint64_t from=(uint64_t)(changes[zz].first*samplesPerUnit);
+		uint64_t to=(zz+1<changes.size())?(uint64_t)(changes[zz+1].first*samplesPerUnit):samples.count;
+		setSamples(samples,from,to,changes[zz].second);
+	}
+	return 1;
+}
+
+static uint8_t idleLevel(const sampleBuffer &samples)
+{
+	// every frame ends with a stop bit, so a recording ends at the idle level
+	return samples.count?sampleAt(samples,samples.count-1):1;
+}
+
+struct decodeStats
+{
+	unsigned long frames;
+	unsigned long framingErrors; // stop bit not at idle level
+	unsigned long glitches; // start edge without a start bit
+};
+
+static void decode(sampleBuffer &samples, double samplesPerBit, uint8_t idle, double sampleRate, decodeStats *stats)
+{
+	// normalize: idle = 0, so a start bit is the first 1 after a 0
+	if (idle)
+		for (size_t zz=0;zz<samples.words.size();zz++)
+			samples.words[zz]=~samples.words[zz];
+
+	uint8_t alphabet=1;
+	uint8_t lineStart=1;
+	uint64_t position=findSample(samples,0,0); // skip a frame that is cut off at the start
+	memset(stats,0,sizeof(*stats));
+
+	for (;;)
+	{
+		uint64_t start=findSample(samples,position,1);
+		uint64_t stop=start+(uint64_t)(6.5*samplesPerBit);
+		if (stop>=samples.count) break;
+
+		if (!sampleAt(samples,start+(uint64_t)(samplesPerBit/2)))
+		{
+			stats->glitches++;
+			position=findSample(samples,start,0);
+			continue;
+		}
+
+		// data bits are sampled in the middle, mark (idle level) is a 1, the first bit is the LSB
+		uint8_t code=0;
+		for (uint8_t zz=0;zz<5;zz++)
+			code|=(!sampleAt(samples,start+(uint64_t)((zz+1.5)*samplesPerBit)))<<zz;
+		if (sampleAt(samples,stop))
+			stats->framingErrors++;
+		stats->frames++;
+		position=findSample(samples,stop,0);
+
+		// the same tables the telex prints with, '^' and '~' are the shift symbols
+		uint8_t c=(alphabet==2)?telex::alphabet2[code]:telex::alphabet1[code];
+		if (c=='^') alphabet=1;
+		else if (c=='~') alphabet=2;
+
+		if (rawFrames)
+		{
+			printf("%.6f 0x%02x %c\n",start/sampleRate,code,(c>=0x20)?c:'.');
+			continue;
+		}
+		if ((c=='^')||(c=='~')||(c=='*')||(c==0x0d)) continue; // shifts, NULL and CR print nothing
+		if ((timestamps)&&(lineStart)) printf("[%.3f] ",start/sampleRate);
+		putchar(c);
+		lineStart=(c==0x0a);
+	}
+	if ((!rawFrames)&&(!lineStart)) putchar('\n');
+}
+
+static double elapsed_s(const struct timespec *start)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC,&now);
+	return (now.tv_sec-start->tv_sec)+(now.tv_nsec-start->tv_nsec)/1e9;
+}
+
+int main(int argc, char **argv)
+{
+	parse_opts(argc,argv);
+
+	unsigned long symbolTime=0;
+	for (uint8_t zz=0;zz<TELEX_BAUD_PROFILES;zz++)
+		if (!strcmp(telex::baudProfiles[zz].name,baudrate)) symbolTime=telex::baudProfiles[zz].symbolTime;
+	if (!symbolTime)
+	{
+		printf("Invalid parameters: unsupported baud rate %s\n",baudrate);
+		return 1;
+	}
+
+	struct timespec start;
+	clock_gettime(CLOCK_MONOTONIC,&start);
+	sampleBuffer samples;
+	if (!strcmp(format,"raw"))
+	{
+		if (rate<=0)
+		{
+			printf("Invalid parameters: raw input needs the sample rate (-r)\n");
+			return 1;
+		}
+		if (!loadRaw(argv[optind],samples))
+		{
+			perror("Unable to read samples");
+			return 1;
+		}
+	}
+	else if (!strcmp(format,"vcd"))
+	{
+		rate=VCD_SAMPLES_PER_BIT*1e6/symbolTime;
+		if (!loadVCD(argv[optind],rate,samples))
+		{
+			fprintf(stderr,"Unable to read signal from %s\n",argv[optind]);
+			return 1;
+		}
+	}
+	else
+		print_usage(argv[0]);
+	if (!samples.count)
+	{
+		fprintf(stderr,"No samples in %s\n",argv[optind]);
+		return 1;
+	}
+
+	double samplesPerBit=rate*symbolTime/1e6;
+	if (samplesPerBit<2)
+	{
+		printf("Invalid parameters: sample rate too low for %s baud\n",baudrate);
+		return 1;
+	}
+
+	decodeStats stats;
+	decode(samples,samplesPerBit,(lineIdle<0)?idleLevel(samples):lineIdle,rate,&stats);
+	fflush(stdout);
+
+	double duration=samples.count/rate, took=elapsed_s(&start);
+	fprintf(stderr,"%lu frames (%lu framing errors, %lu glitches) in %.1f s of signal, decoded in %.3f s (%.0fx real time)\n",
+		stats.frames,stats.framingErrors,stats.glitches,duration,took,(took>0)?duration/took:0);
+	return 0;
+}
@@ -0,0 +1,231 @@
+#include <limits.h>
+#include <string.h>
+#include "telexEnvelope.h"
+#include "telexTranslit.h"
+
+static const char *skipSpace(const char *p, const char *end)
+{
+	while ((p<end)&&((*p==' ')||(*p=='\t')||(*p=='\r')||(*p=='\n'))) p++;
+	return p;
+}
+
+static const char *parseString(const char *p, const char *end, telexView *view)
+{
+	// p is on the opening quote, returns the position after the closing quote (0 on error)
+	view->data=++p;
+	view->escaped=0;
+	while (p<end)
+	{
+		if (*p=='"')
+		{
+			view->length=p-view->data;
+			return p+1;
+		}
+		if (*p=='\\')
+		{
+			view->escaped=1;
+			p++;
+		}
+		p++;
+	}
+	return 0;
+}
+
+static const char *parseNumber(const char *p, const char *end, long limit, long *value)
+{
+	// integer up to limit (either sign), returns 0 when it is missing or out of range
+	uint8_t negative=0, digits=0;
+	*value=0;
+	if ((p<end)&&(*p=='-')) { negative=1; p++; }
+	while ((p<end)&&(*p>='0')&&(*p<='9'))
+	{
+		long digit=*p++-'0';
+		if (*value>(limit-digit)/10) return 0;
+		*value=*value*10+digit;
+		digits++;
+	}
+	if (!digits) return 0;
+	if (negative) *value=-*value;
+	return p;
+}
+
+static const char *skipValue(const char *p, const char *end)
+{
+	// values of fields we do not know: strings, numbers, literals and nested objects/arrays
+	telexView view;
+	if (p>=end) return 0;
+	if (*p=='"') return parseString(p,end,&view);
+	if ((*p=='-')||((*p>='0')&&(*p<='9')))
+	{
+		while ((p<end)&&(strchr(".eE+-0123456789",*p))) p++; // any size, with fraction / exponent
+		return p;
+	}
+	if ((*p=='{')||(*p=='['))
+	{
+		int depth=0;
+		while (p<end)
+		{
+			if (*p=='"')
+			{
+				if (!(p=parseString(p,end,&view))) return 0;
+				continue;
+			}
+			if ((*p=='{')||(*p=='[')) depth++;
+			else if (((*p=='}')||(*p==']'))&&(!--depth)) return p+1;
+			p++;
+		}
+		return 0;
+	}
+	while ((p<end)&&(*p>='a')&&(*p<='z')) p++; // true, false, null
+	return p;
+}
+
+static uint8_t keyEquals(const telexView &key, const char *name)
+{
+	return ((!key.escaped)&&(key.length==strlen(name))&&(!memcmp(key.data,name,key.length)));
+}
+
+uint8_t telexParseEnvelope(const char *data, size_t length, telexEnvelope *envelope)
+{
+	const char *p=data, *end=data+length;
+	telexView key, value;
+	long number;
+
+	memset(envelope,0,sizeof(*envelope));
+	envelope->priority=-1;
+	envelope->ttl=-1;
+	envelope->color=-1;
+
+	p=skipSpace(p,end);
+	if ((p>=end)||(*p!='{')) return 0;
+	p=skipSpace(p+1,end);
+	while ((p<end)&&(*p!='}'))
+	{
+		if ((*p!='"')||(!(p=parseString(p,end,&key)))) return 0;
+		p=skipSpace(p,end);
+		if ((p>=end)||(*p!=':')) return 0;
+		p=skipSpace(p+1,end);
+		if (p>=end) return 0;
+
+		if ((keyEquals(key,"pri"))||(keyEquals(key,"ttl")))
+		{
+			// ttl is added to the current time, an int of seconds can not overflow it
+			if (!(p=parseNumber(p,end,INT_MAX,&number))) return 0;
+			if (keyEquals(key,"pri")) envelope->priority=(number<0)?0:number;
+			else envelope->ttl=(number<0)?0:number;
+		}
+		else if ((*p=='"')&&((keyEquals(key,"id"))||(keyEquals(key,"printer"))||(keyEquals(key,"header"))||
+		         (keyEquals(key,"text"))||(keyEquals(key,"color"))))
+		{
+			if (!(p=parseString(p,end,&value))) return 0;
+			if (keyEquals(key,"id")) envelope->id=value;
+			else if (keyEquals(key,"printer")) envelope->printer=value;
+			else if (keyEquals(key,"header")) envelope->header=value;
+			else if (keyEquals(key,"text")) envelope->text=value;
+			else envelope->color=telexViewEquals(value,"red")?TELEX_COLOR_RED:TELEX_COLOR_BLACK;
+		}
+		else if ((keyEquals(key,"color"))&&(*p>='0')&&(*p<='1'))
+		{
+			if (!(p=parseNumber(p,end,1,&number))) return 0;
+			envelope->color=number?TELEX_COLOR_RED:TELEX_COLOR_BLACK;
+		}
+		else if (!(p=skipValue(p,end)))
+			return 0;
+
+		p=skipSpace(p,end);
+		if ((p<end)&&(*p==',')) p=skipSpace(p+1,end);
+	}
+	if (p>=end) return 0; // no closing brace
+	return (envelope->text.data!=0);
+}
+
+static uint8_t hexDigit(char c, uint32_t *value)
+{
+	if ((c>='0')&&(c<='9')) *value=(*value<<4)|(c-'0');
+	else if ((c>='a')&&(c<='f')) *value=(*value<<4)|(c-'a'+10);
+	else if ((c>='A')&&(c<='F')) *value=(*value<<4)|(c-'A'+10);
+	else return 0;
+	return 1;
+}
+
+void telexViewString(const telexView &view, std::string &out)
+{
+	if (!view.escaped)
+	{
+		out.append(view.data,view.length);
+		return;
+	}
+
+	for (size_t zz=0;zz<view.length;zz++)
+	{
+		char c=view.data[zz];
+		if ((c!='\\')||(zz+1>=view.length))
+		{
+			out+=c;
+			continue;
+		}
+		c=view.data[++zz];
+		switch (c)
+		{
+			case 'n': out+='\n'; break;
+			case 'r': out+='\r'; break;
+			case 't': out+='\t'; break;
+			case 'b': case 'f': break;
+			case 'u':
+				{
+					// \uXXXX, re-encoded as UTF-8 (transliterated later like any other input)
+					uint32_t codePoint=0;
+					uint8_t valid=(zz+4<view.length);
+					for (uint8_t yy=1;(valid)&&(yy<=4);yy++)
+						valid=hexDigit(view.data[zz+yy],&codePoint);
+					if (!valid)
+					{
+						out+=TRANSLIT_PLACEHOLDER;
+						break;
+					}
+					zz+=4;
+					if (codePoint<0x80) out+=(char)codePoint;
+					else if (codePoint<0x800)
+					{
+						out+=(char)(0xc0|(codePoint>>6));
+						out+=(char)(0x80|(codePoint&0x3f));
+					}
+					else
+					{
+						out+=(char)(0xe0|(codePoint>>12));
+						out+=(char)(0x80|((codePoint>>6)&0x3f));
+						out+=(char)(0x80|(codePoint&0x3f));
+					}
+				}
+				break;
+			default: out+=c; // \" \\ \/
+		}
+	}
+}
+
+uint8_t telexViewEquals(const telexView &view, const char *string)
+{
+	return ((view.data)&&(view.length==strlen(string))&&(!memcmp(view.data,string,view.length)));
+}
+
+telexDedup::telexDedup(void)
+{
+	this->next=0;
+	this->count=0;
+}
+
+uint8_t telexDedup::seen(const telexView &id)
+{
+	// FNV-1a hash of the raw id
+	uint64_t hash=0xcbf29ce484222325ULL;
+	for (size_t zz=0;zz<id.length;zz++)
+		hash=(hash^(uint8_t)id.data[zz])*0x100000001b3ULL;
+
+	for (size_t zz=0;zz<this->count;zz++)
+		if (this->ids[zz]==hash) return 1;
+
+	this->ids[this->next]=hash;
+	this->next=(this->next+1)%TELEX_DEDUP_IDS;
+	if (this->count<TELEX_DEDUP_IDS) this->count++;
+	return 0;
+}
@@ -0,0 +1,56 @@
+#ifndef TELEX_ENVELOPE_H
+#define TELEX_ENVELOPE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+
+// Optional message envelope: a flat JSON object such as
+//   {"pri":2,"ttl":600,"id":"sat-4711","printer":"hq","color":"red","header":"+++ %d.%m.%Y %H:%M +++","text":"..."}
+// parsed in place, string fields are views into the payload (no DOM, no copies).
+// Payloads that are not an envelope (no object with a "text" field) are printed as plain text.
+
+#define TELEX_COLOR_BLACK 0
+#define TELEX_COLOR_RED 1
+
+// ids of the most recent messages kept for duplicate detection
+#define TELEX_DEDUP_IDS 256
+
+struct telexView
+{
+	const char *data; // 0 when the field is absent
+	size_t length;
+	uint8_t escaped; // contains backslash escapes, use telexViewString to decode
+};
+
+struct telexEnvelope
+{
+	int priority; // -1 when absent
+	long ttl; // seconds, -1 when absent
+	int color; // TELEX_COLOR_BLACK / TELEX_COLOR_RED, -1 when absent
+	telexView id;
+	telexView printer;
+	telexView header; // strftime template printed before the text
+	telexView text;
+};
+
+// returns 0 when the payload is not an envelope (print it as it is)
+uint8_t telexParseEnvelope(const char *data, size_t length, telexEnvelope *envelope);
+// appends the decoded string to out
+void telexViewString(const telexView &view, std::string &out);
+uint8_t telexViewEquals(const telexView &view, const char *string);
+
+// ring of hashes of recently seen message ids
+class telexDedup
+{
+	private:
+		uint64_t ids[TELEX_DEDUP_IDS];
+		size_t next;
+		size_t count;
+
+	public:
+		telexDedup(void);
+		uint8_t seen(const telexView &id); // 1 for a duplicate, otherwise the id is remembered
+};
+
+#endif
@@ -0,0 +1,293 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <deque>
+#include <algorithm>
+#include "telexFilter.h"
+#include "telexTranslit.h"
+#include "telexLog.h"
+
+#define FILTER_NO_OUTPUT 0xffffffff
+
+static uint8_t fold(uint8_t c)
+{
+	return ((c>='A')&&(c<='Z'))?c+('a'-'A'):c;
+}
+
+static std::string unescape(const char *text)
+{
+	std::string out;
+	for (;*text;text++)
+	{
+		if ((*text!='\\')||(!text[1]))
+		{
+			out+=*text;
+			continue;
+		}
+		text++;
+		if (*text=='n') out+='\n';
+		else if (*text=='t') out+='\t';
+		else if ((*text=='x')&&(text[1])&&(text[2]))
+		{
+			char hex[3]={text[1],text[2],0};
+			out+=(char)strtoul(hex,NULL,16);
+			text+=2;
+		}
+		else out+=*text;
+	}
+	return out;
+}
+
+telexFilter::telexFilter(void)
+{
+	this->minPrintable=0;
+	this->minprintHits=0;
+	this->passed=0;
+	this->compile();
+}
+
+uint8_t telexFilter::addRule(uint8_t type, const std::string &pattern, const std::string &replacement, unsigned line)
+{
+	if (pattern.empty()) return 0;
+
+	telexFilterRule rule;
+	rule.type=type;
+	for (size_t zz=0;zz<pattern.length();zz++)
+		rule.pattern+=(char)fold(pattern[zz]);
+	rule.replacement=replacement;
+	rule.line=line;
+	rule.hits=0;
+	this->rules.push_back(rule);
+	this->compile();
+	return 1;
+}
+
+void telexFilter::setMinPrintable(double ratio)
+{
+	this->minPrintable=ratio;
+}
+
+uint8_t telexFilter::load(const char *path)
+{
+	FILE *f=fopen(path,"r");
+	char line[512];
+	unsigned number=0;
+	uint8_t valid=1;
+
+	if (!f) return 0;
+	while (fgets(line,sizeof(line),f))
+	{
+		number++;
+		line[strcspn(line,"\r\n")]=0;
+		if ((!line[0])||(line[0]=='#')) continue;
+
+		char *argument=strchr(line,' ');
+		if (argument) *argument++=0;
+		if ((argument)&&(!strcmp(line,"drop")))
+			valid&=this->addRule(TELEX_FILTER_DROP,unescape(argument),"",number);
+		else if ((argument)&&(!strcmp(line,"trim")))
+			valid&=this->addRule(TELEX_FILTER_TRIM,unescape(argument),"",number);
+		else if ((argument)&&(!strcmp(line,"rewrite"))&&(strstr(argument," => ")))
+		{
+			char *replacement=strstr(argument," => ");
+			*replacement=0;
+			valid&=this->addRule(TELEX_FILTER_REWRITE,unescape(argument),unescape(replacement+4),number);
+		}
+		else if ((argument)&&(!strcmp(line,"minprint")))
+			this->minPrintable=atof(argument);
+		else
+		{
+			telexLog(TELEX_LOG_ERROR,TELEX_LOG_GENERAL,"%s:%u: invalid filter rule\n",path,number);
+			valid=0;
+		}
+	}
+	fclose(f);
+	return valid;
+}
+
+void telexFilter::compile(void)
+{
+	// input classes: one per distinct byte in the patterns (after case folding), all others share class 0
+	memset(this->classes,0,sizeof(this->classes));
+	this->classCount=1;
+	for (size_t zz=0;zz<this->rules.size();zz++)
+		for (size_t yy=0;yy<this->rules[zz].pattern.length();yy++)
+		{
+			uint8_t c=this->rules[zz].pattern[yy];
+			if (!this->classes[c]) this->classes[c]=this->classCount++;
+		}
+	for (unsigned c=0;c<256;c++)
+		this->classes[c]=this->classes[fold(c)];
+
+	// trie of the patterns (0 = no transition yet, state 0 is the root)
+	this->next.assign(this->classCount,0);
+	this->output.assign(1,-1);
+	for (size_t zz=0;zz<this->rules.size();zz++)
+	{
+		uint32_t state=0;
+		const std::string &pattern=this->rules[zz].pattern;
+		for (size_t yy=0;yy<pattern.length();yy++)
+		{
+			uint32_t &target=this->next[state*this->classCount+this->classes[(uint8_t)pattern[yy]]];
+			if (!target)
+			{
+				target=this->output.size();
+				this->next.resize(this->next.size()+this->classCount,0);
+				this->output.push_back(-1);
+			}
+			state=this->next[state*this->classCount+this->classes[(uint8_t)pattern[yy]]];
+		}
+		if (this->output[state]<0) this->output[state]=zz; // the first of equal patterns wins
+	}
+
+	// breadth first: failure links turn the trie into a DFA, outputLink chains the shorter patterns
+	// that end in the same place
+	std::vector<uint32_t> failure(this->output.size(),0);
+	this->outputLink.assign(this->output.size(),FILTER_NO_OUTPUT);
+	std::deque<uint32_t> pending;
+	for (unsigned c=0;c<this->classCount;c++)
+		if (this->next[c]) pending.push_back(this->next[c]);
+	while (!pending.empty())
+	{
+		uint32_t state=pending.front();
+		pending.pop_front();
+		uint32_t fail=failure[state];
+		this->outputLink[state]=(this->output[fail]>=0)?fail:this->outputLink[fail];
+		for (unsigned c=0;c<this->classCount;c++)
+		{
+			uint32_t &target=this->next[state*this->classCount+c];
+			if (target)
+			{
+				failure[target]=this->next[fail*this->classCount+c];
+				pending.push_back(target);
+			}
+			else
+				target=this->next[fail*this->classCount+c];
+		}
+	}
+	// class 0 never occurs in a pattern, so every state returns to the root on it
+}
+
+struct filterEdit
+{
+	size_t start, end;
+	int rule;
+};
+
+static bool leftmostLongest(const filterEdit &a, const filterEdit &b)
+{
+	return (a.start<b.start)||((a.start==b.start)&&(a.end>b.end));
+}
+
+uint8_t telexFilter::apply(const char *data, size_t length, std::string &out, uint8_t *changed)
+{
+	std::vector<filterEdit> edits; // longest rewrite match for every end position
+	uint32_t state=0;
+	int trim=-1;
+
+	// trailing white space is ignored when trimming
+	size_t end=length;
+	while ((end)&&((data[end-1]==' ')||(data[end-1]=='\n')||(data[end-1]=='\r')||(data[end-1]=='\t'))) end--;
+
+	*changed=0;
+	for (size_t zz=0;zz<length;zz++)
+	{
+		state=this->next[state*this->classCount+this->classes[(uint8_t)data[zz]]];
+		uint32_t match=(this->output[state]>=0)?state:this->outputLink[state];
+		uint8_t rewritten=0;
+		for (;match!=FILTER_NO_OUTPUT;match=this->outputLink[match])
+		{
+			int index=this->output[match];
+			telexFilterRule &rule=this->rules[index];
+			size_t start=zz+1-rule.pattern.length();
+			switch (rule.type)
+			{
+				case TELEX_FILTER_DROP:
+					rule.hits++;
+					telexLog(TELEX_LOG_INFO,TELEX_LOG_MQTT,"Dropping payload (filter rule in line %u)\n",rule.line);
+					return 0;
+				case TELEX_FILTER_REWRITE:
+					// the longest pattern ending here comes first on the chain
+					if (!rewritten)
+					{
+						filterEdit e={start,zz+1,index};
+						edits.push_back(e);
+						rewritten=1;
+					}
+					break;
+				case TELEX_FILTER_TRIM:
+					if ((zz+1==end)&&(trim<0)) trim=index;
+					break;
+			}
+		}
+	}
+
+	if (this->minPrintable>0)
+	{
+		size_t printable=0, total=0;
+		for (size_t zz=0;zz<length;)
+		{
+			uint8_t len;
+			uint32_t codePoint;
+			if ((uint8_t)data[zz]<0x80) { codePoint=(uint8_t)data[zz]; len=1; }
+			else if (length-zz<4)
+			{
+				// utf8Decode reads up to 3 bytes ahead, copy the tail so it stays in the payload
+				uint8_t tail[4]={0,0,0,0};
+				memcpy(tail,data+zz,length-zz);
+				codePoint=utf8Decode(tail,&len);
+			}
+			else
+				codePoint=utf8Decode((const uint8_t *)data+zz,&len);
+			if (((codePoint>=0x20)&&(codePoint<0x7f))||(codePoint=='\n')||(codePoint=='\r')||(codePoint=='\t')||
+			    ((codePoint>=0x80)&&(ita2Transliterate(codePoint))))
+				printable++;
+			total++;
+			zz+=len;
+		}
+		if ((total)&&((double)printable/total<this->minPrintable))
+		{
+			this->minprintHits++;
+			telexLog(TELEX_LOG_INFO,TELEX_LOG_MQTT,"Dropping payload (%lu of %lu characters printable)\n",(unsigned long)printable,(unsigned long)total);
+			return 0;
+		}
+	}
+
+	this->passed++;
+	if ((edits.empty())&&(trim<0)) return 1;
+
+	// rewrites apply leftmost-longest without overlaps (matches are few, sorting them is cheap),
+	// rewrites that overlap the trimmed tail are skipped
+	std::sort(edits.begin(),edits.end(),leftmostLongest);
+	size_t trimStart=(trim>=0)?end-this->rules[trim].pattern.length():length;
+	size_t position=0;
+	out.clear();
+	for (size_t zz=0;zz<edits.size();zz++)
+	{
+		if (edits[zz].start<position) continue;
+		if (edits[zz].end>trimStart) continue;
+		out.append(data+position,edits[zz].start-position);
+		out+=this->rules[edits[zz].rule].replacement;
+		position=edits[zz].end;
+		this->rules[edits[zz].rule].hits++;
+	}
+	if (trim>=0)
+	{
+		out.append(data+position,trimStart-position);
+		out.append(data+end,length-end);
+		this->rules[trim].hits++;
+	}
+	else
+		out.append(data+position,length-position);
+	*changed=1;
+	return 1;
+}
+
+void telexFilter::logStats(void)
+{
+	static const char *types[]={"drop","rewrite","trim"};
+	telexLog(TELEX_LOG_INFO,TELEX_LOG_GENERAL,"Filter: %lu payloads passed, %lu dropped as unprintable\n",this->passed,this->minprintHits);
+	for (size_t zz=0;zz<this->rules.size();zz++)
+		telexLog(TELEX_LOG_INFO,TELEX_LOG_GENERAL,"Filter rule %u (%s '%s'): %lu hits\n",
+			this->rules[zz].line,types[this->rules[zz].type],this->rules[zz].pattern.c_str(),this->rules[zz].hits);
+}
@@ -0,0 +1,59 @@
+#ifndef TELEX_FILTER_H
+#define TELEX_FILTER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+// Ingest filter: rules that drop, rewrite or trim payloads before they are queued, compiled into
+// one Aho-Corasick automaton so a payload is scanned once, in time linear in its length,
+// however many rules there are. Rule file, one rule per line (# starts a comment):
+//   drop <pattern>                   drop payloads that contain the pattern
+//   rewrite <pattern> => <text>      replace the pattern (matches do not overlap)
+//   trim <pattern>                   remove the pattern at the end of the payload
+//   minprint <ratio>                 drop payloads with fewer printable characters than this (0..1)
+// Patterns match ASCII case-insensitively, \n \t \\ and \xHH escape special bytes.
+
+#define TELEX_FILTER_DROP 0
+#define TELEX_FILTER_REWRITE 1
+#define TELEX_FILTER_TRIM 2
+
+struct telexFilterRule
+{
+	uint8_t type;
+	std::string pattern; // folded to lower case
+	std::string replacement;
+	unsigned line; // in the rule file
+	unsigned long hits;
+};
+
+class telexFilter
+{
+	private:
+		std::vector<telexFilterRule> rules;
+		uint8_t classes[256]; // byte -> input class of the automaton (0 for bytes in no pattern)
+		unsigned classCount;
+		std::vector<uint32_t> next; // states * classCount transitions
+		std::vector<int> output; // longest rule ending in a state, -1 if none
+		std::vector<uint32_t> outputLink; // next state on the failure chain with an output
+		double minPrintable;
+
+	private:
+		void compile(void);
+
+	public:
+		unsigned long minprintHits;
+		unsigned long passed;
+
+	public:
+		telexFilter(void);
+		uint8_t load(const char *path);
+		uint8_t addRule(uint8_t type, const std::string &pattern, const std::string &replacement="", unsigned line=0);
+		void setMinPrintable(double ratio);
+		// returns 0 when the payload is dropped; out is only filled (and *changed set) when the payload is modified
+		uint8_t apply(const char *data, size_t length, std::string &out, uint8_t *changed);
+		void logStats(void);
+};
+
+#endif
@@ -0,0 +1,148 @@
+#include "telexLayout.h"
+
+// printed width of a character, bell (%) and null (*) do not move the carriage
+static uint8_t layoutCharWidth(char c)
+{
+	return ((c=='%')||(c=='*'))?0:1;
+}
+
+static size_t layoutWidth(const std::string &text, size_t start, size_t end)
+{
+	size_t width=0;
+	for (size_t zz=start;zz<end;zz++)
+		width+=layoutCharWidth(text[zz]);
+	return width;
+}
+
+// appends one line of text (without newline), wrapping on word boundaries
+static void layoutLine(const std::string &line, std::string &out, size_t *column, uint8_t width)
+{
+	size_t zz=0;
+	while (zz<line.length())
+	{
+		size_t wordStart=zz;
+		while ((wordStart<line.length())&&(line[wordStart]==' ')) wordStart++;
+		size_t wordEnd=wordStart;
+		while ((wordEnd<line.length())&&(line[wordEnd]!=' ')) wordEnd++;
+		if (wordStart==wordEnd) break; // only (trailing) spaces left
+
+		size_t spaces=wordStart-zz;
+		size_t wordWidth=layoutWidth(line,wordStart,wordEnd);
+
+		if (*column+spaces+wordWidth<=width)
+		{
+			out.append(line,zz,wordEnd-zz);
+			*column+=spaces+wordWidth;
+		}
+		else if (wordWidth<=width)
+		{
+			// break before the word, the spaces at the break are never printed (at column 0 this
+			// is indentation wider than the line, the word then starts the line)
+			if (*column) out+='\n';
+			out.append(line,wordStart,wordEnd-wordStart);
+			*column=wordWidth;
+		}
+		else
+		{
+			// word longer than a line: start on a fresh line and break it hard
+			if (*column)
+			{
+				out+='\n';
+				*column=0;
+			}
+			for (size_t yy=wordStart;yy<wordEnd;yy++)
+			{
+				uint8_t charWidth=layoutCharWidth(line[yy]);
+				if (*column+charWidth>width)
+				{
+					out+='\n';
+					*column=0;
+				}
+				out+=line[yy];
+				*column+=charWidth;
+			}
+		}
+		zz=wordEnd;
+	}
+}
+
+void telexLayoutInit(telexLayoutState *state, uint8_t startColumn)
+{
+	state->column=startColumn;
+	state->blankLine=0;
+	state->started=0;
+	state->open=0;
+	state->spaces=0;
+}
+
+void telexLayoutAppend(const std::string &text, std::string &out, telexLayoutState *state, uint8_t width)
+{
+	std::string line;
+
+	out.reserve(out.length()+text.length()+text.length()/width+2);
+
+	size_t zz=0;
+	while (zz<text.length())
+	{
+		size_t end=text.find('\n',zz);
+		uint8_t complete=(end!=std::string::npos);
+		if (!complete) end=text.length();
+
+		line.assign(state->spaces,' ');
+		state->spaces=0;
+		for (size_t yy=zz;yy<end;yy++)
+		{
+			if (text[yy]=='\r') continue; // <CR> is added to every <LF> by the telex
+			line+=(text[yy]=='\t')?' ':text[yy];
+		}
+		size_t last=line.find_last_not_of(' ');
+		last=(last==std::string::npos)?0:last+1;
+		if (!complete) state->spaces=line.length()-last; // they may separate this part from the next
+		line.erase(last); // never print spaces that are returned over
+		zz=end+1;
+
+		if (state->open)
+			layoutLine(line,out,&state->column,width); // continues the unfinished line of the last part
+		else if (line.find_first_not_of(' ')==std::string::npos)
+		{
+			if (complete) state->blankLine=state->started; // leading blank lines are dropped, others collapse to one
+			continue;
+		}
+		else
+		{
+			if (state->blankLine)
+			{
+				out+='\n';
+				state->blankLine=0;
+			}
+			layoutLine(line,out,&state->column,width);
+			state->started=1;
+		}
+
+		state->open=!complete;
+		if (complete)
+		{
+			out+='\n';
+			state->column=0;
+		}
+	}
+}
+
+void telexLayoutFinish(std::string &out, telexLayoutState *state)
+{
+	state->spaces=0; // trailing spaces are not printed
+	if (!state->open) return;
+	out+='\n';
+	state->column=0;
+	state->open=0;
+}
+
+void telexLayout(const std::string &text, std::string &out, uint8_t startColumn, uint8_t width)
+{
+	telexLayoutState state;
+
+	out.clear();
+	telexLayoutInit(&state,startColumn);
+	telexLayoutAppend(text,out,&state,width);
+	telexLayoutFinish(out,&state);
+}
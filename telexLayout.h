@@ -0,0 +1,38 @@
+#ifndef TELEX_LAYOUT_H
+#define TELEX_LAYOUT_H
+
+#include <stdint.h>
+#include <string>
+#include "telex.h"
+
+struct telexLayoutStats
+{
+	unsigned long symbolsBefore; // raw symbols when printed with hard line breaks
+	unsigned long symbolsAfter; // raw symbols after layout
+	unsigned long returnColumnsBefore; // total carriage return travel (columns) with hard line breaks
+	unsigned long returnColumnsAfter; // total carriage return travel (columns) after layout
+	unsigned long timeSaved; // estimated print time saved (milli seconds)
+};
+
+// layout state kept between the parts of a message that is laid out incrementally
+struct telexLayoutState
+{
+	size_t column; // column the next line starts at
+	uint8_t blankLine; // a blank line is pending
+	uint8_t started; // something was printed already
+	uint8_t open; // the last line has no newline yet, the next text continues it at column
+	size_t spaces; // spaces at the end of the last part, put before the next part (word separator)
+};
+
+// word wraps a message for the telex, text must be ASCII (see ita2Transliterate)
+// trailing spaces are trimmed, runs of blank lines collapse to one blank line and
+// the result always ends with a newline (unless there is nothing to print)
+void telexLayout(const std::string &text, std::string &out, uint8_t startColumn=0, uint8_t width=TELEX_LINE_WIDTH);
+
+// incremental version of telexLayout: appends the layout of the next part of a message to out,
+// a part may end inside a line (the next part continues it), telexLayoutFinish ends the message
+void telexLayoutInit(telexLayoutState *state, uint8_t startColumn=0);
+void telexLayoutAppend(const std::string &text, std::string &out, telexLayoutState *state, uint8_t width=TELEX_LINE_WIDTH);
+void telexLayoutFinish(std::string &out, telexLayoutState *state);
+
+#endif
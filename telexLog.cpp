@@ -0,0 +1,168 @@
+#include <stdio.h>
+#include <stdarg.h>
+#include <time.h>
+#include <unistd.h>
+#include <atomic>
+#include <thread>
+#include "telexLog.h"
+
+// flush thread poll interval when the ring is empty (micro seconds)
+#define TELEX_LOG_IDLE_TIME 5000
+
+// bounded multi producer queue (D. Vyukov), every slot carries the sequence number of the
+// position it is ready for: producers claim a position with one compare and swap, the single
+// consumer (flush thread) never blocks them
+struct telexLogSlot
+{
+	std::atomic<uint32_t> sequence;
+	uint16_t length;
+	char text[TELEX_LOG_MESSAGE_SIZE];
+};
+
+struct telexLogRateLimit
+{
+	std::atomic<unsigned> perSecond;
+	std::atomic<time_t> window;
+	std::atomic<unsigned> count;
+	std::atomic<unsigned long> suppressed;
+};
+
+static const char *logCategoryNames[TELEX_LOG_CATEGORIES]={"general","echo","power","layout","mqtt"};
+
+static telexLogSlot logRing[TELEX_LOG_SLOTS];
+static std::atomic<uint32_t> logEnqueuePos(0);
+static uint32_t logDequeuePos=0;
+static std::atomic<unsigned long> logDropped(0);
+static telexLogRateLimit logRateLimits[TELEX_LOG_CATEGORIES];
+#ifdef DEBUG
+static std::atomic<uint8_t> logLevel(TELEX_LOG_DEBUG);
+#else
+static std::atomic<uint8_t> logLevel(TELEX_LOG_INFO);
+#endif
+
+static std::thread logThread;
+static std::atomic<bool> logRunning(false);
+
+static bool initLogRing(void)
+{
+	for (uint32_t zz=0;zz<TELEX_LOG_SLOTS;zz++)
+		logRing[zz].sequence.store(zz,std::memory_order_relaxed);
+	return true;
+}
+static bool logRingReady=initLogRing();
+
+static bool logRateLimited(uint8_t category)
+{
+	telexLogRateLimit *limit=&logRateLimits[category];
+	unsigned perSecond=limit->perSecond.load(std::memory_order_relaxed);
+	if (!perSecond) return false;
+
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC_COARSE,&now);
+	time_t window=limit->window.load(std::memory_order_relaxed);
+	if ((window!=now.tv_sec)&&(limit->window.compare_exchange_strong(window,now.tv_sec)))
+		limit->count.store(0,std::memory_order_relaxed);
+	if (limit->count.fetch_add(1,std::memory_order_relaxed)<perSecond) return false;
+
+	limit->suppressed.fetch_add(1,std::memory_order_relaxed);
+	return true;
+}
+
+void telexLog(uint8_t level, uint8_t category, const char *format, ...)
+{
+	if ((level>logLevel.load(std::memory_order_relaxed))||(category>=TELEX_LOG_CATEGORIES)) return;
+	if (logRateLimited(category)) return;
+
+	// claim a slot
+	telexLogSlot *slot;
+	uint32_t pos=logEnqueuePos.load(std::memory_order_relaxed);
+	for (;;)
+	{
+		slot=&logRing[pos&(TELEX_LOG_SLOTS-1)];
+		int32_t diff=(int32_t)(slot->sequence.load(std::memory_order_acquire)-pos);
+		if (diff==0)
+		{
+			if (logEnqueuePos.compare_exchange_weak(pos,pos+1,std::memory_order_relaxed)) break;
+		}
+		else if (diff<0)
+		{
+			logDropped.fetch_add(1,std::memory_order_relaxed); // ring full
+			return;
+		}
+		else
+			pos=logEnqueuePos.load(std::memory_order_relaxed);
+	}
+
+	va_list args;
+	va_start(args,format);
+	int length=vsnprintf(slot->text,TELEX_LOG_MESSAGE_SIZE,format,args);
+	va_end(args);
+	slot->length=(length<0)?0:(length>=TELEX_LOG_MESSAGE_SIZE)?TELEX_LOG_MESSAGE_SIZE-1:length;
+	slot->sequence.store(pos+1,std::memory_order_release);
+}
+
+void telexLogSetLevel(uint8_t level)
+{
+	logLevel.store(level);
+}
+
+uint8_t telexLogGetLevel(void)
+{
+	return logLevel.load();
+}
+
+void telexLogSetRateLimit(uint8_t category, unsigned perSecond)
+{
+	if (category<TELEX_LOG_CATEGORIES)
+		logRateLimits[category].perSecond.store(perSecond);
+}
+
+static bool flushLogRing(void)
+{
+	// write out everything that is ready, returns false if there was nothing to write
+	bool written=false;
+	for (;;)
+	{
+		telexLogSlot *slot=&logRing[logDequeuePos&(TELEX_LOG_SLOTS-1)];
+		if ((int32_t)(slot->sequence.load(std::memory_order_acquire)-(logDequeuePos+1))<0) break;
+		fwrite(slot->text,1,slot->length,stdout);
+		slot->sequence.store(logDequeuePos+TELEX_LOG_SLOTS,std::memory_order_release);
+		logDequeuePos++;
+		written=true;
+	}
+
+	unsigned long dropped=logDropped.exchange(0);
+	if (dropped)
+		fprintf(stdout,"[log: %lu messages dropped, ring buffer full]\n",dropped);
+	for (uint8_t zz=0;zz<TELEX_LOG_CATEGORIES;zz++)
+	{
+		unsigned long suppressed=logRateLimits[zz].suppressed.exchange(0);
+		if (suppressed)
+			fprintf(stdout,"[log: %lu %s messages suppressed by rate limit]\n",suppressed,logCategoryNames[zz]);
+	}
+
+	if (written||dropped) fflush(stdout);
+	return written;
+}
+
+static void logFlushThread(void)
+{
+	while (logRunning.load())
+	{
+		if (!flushLogRing())
+			usleep(TELEX_LOG_IDLE_TIME);
+	}
+	flushLogRing();
+}
+
+void telexLogStart(void)
+{
+	if (logRunning.exchange(true)) return;
+	logThread=std::thread(logFlushThread);
+}
+
+void telexLogStop(void)
+{
+	if (!logRunning.exchange(false)) return;
+	logThread.join();
+}
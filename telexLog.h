@@ -0,0 +1,35 @@
+#ifndef TELEX_LOG_H
+#define TELEX_LOG_H
+
+#include <stdint.h>
+
+// Asynchronous logging: messages are formatted into a lock-free ring buffer and written to
+// stdout by a background thread, so the bit timing never waits for a slow console.
+// When the ring is full messages are dropped (and counted) instead of blocking the caller.
+
+// log levels
+#define TELEX_LOG_ERROR 0
+#define TELEX_LOG_WARNING 1
+#define TELEX_LOG_INFO 2
+#define TELEX_LOG_DEBUG 3
+#define TELEX_LOG_TRACE 4
+
+// log categories, each can be rate limited
+#define TELEX_LOG_GENERAL 0
+#define TELEX_LOG_ECHO 1 // characters sent to / received from the telex
+#define TELEX_LOG_POWER 2
+#define TELEX_LOG_LAYOUT 3
+#define TELEX_LOG_MQTT 4
+#define TELEX_LOG_CATEGORIES 5
+
+#define TELEX_LOG_SLOTS 1024 // must be a power of 2
+#define TELEX_LOG_MESSAGE_SIZE 240 // longer messages are truncated
+
+void telexLog(uint8_t level, uint8_t category, const char *format, ...) __attribute__((format(printf,3,4)));
+void telexLogSetLevel(uint8_t level);
+uint8_t telexLogGetLevel(void);
+void telexLogSetRateLimit(uint8_t category, unsigned perSecond); // 0 = no limit
+void telexLogStart(void);
+void telexLogStop(void); // writes out everything that is still queued
+
+#endif
@@ -0,0 +1,290 @@
+#include "telexPrinter.h"
+#include "telexTranslit.h"
+#include "telexLog.h"
+
+telexPrintJob::telexPrintJob(const char *data, size_t length, uint8_t priority, uint8_t filter, uint8_t color, uint8_t format)
+{
+	this->data.assign(data,length);
+	this->position=0;
+	this->pendingPosition=0;
+	this->linePosition=0;
+	this->priority=priority;
+	this->filter=filter;
+	this->color=color;
+	this->format=format;
+	this->started=0;
+	this->savedAlphabet=0;
+	this->savedCursorPos=0;
+	telexLayoutInit(&this->layout);
+}
+
+uint8_t telexPrintJob::nextLine(std::string &line)
+{
+	std::string text;
+
+	if (this->format==TELEX_FORMAT_ITA2)
+	{
+		// symbols need no layout, a line ends with <LF>
+		if (this->position>=this->data.length()) return 0;
+		size_t end=this->position;
+		while ((end<this->data.length())&&(telex::alphabet1[(uint8_t)this->data[end++]]!='\n'));
+		line.assign(this->data,this->position,end-this->position);
+		this->position=end;
+		return 1;
+	}
+
+	// lay out slices until a whole line is pending, a paragraph longer than a slice continues the
+	// line of the previous slice (with the space at the cut as the word separator)
+	while (this->pending.find('\n',this->pendingPosition)==std::string::npos)
+	{
+		if (this->position>=this->data.length())
+		{
+			if (this->pendingPosition>=this->pending.length()) return 0;
+			break;
+		}
+
+		// next input line, long paragraphs are cut at a word boundary (never inside a UTF-8 sequence)
+		size_t end=this->data.find('\n',this->position);
+		if ((end==std::string::npos)||(end-this->position>TELEX_JOB_SLICE))
+		{
+			end=this->position+TELEX_JOB_SLICE;
+			if (end>=this->data.length())
+				end=this->data.length();
+			else
+			{
+				size_t space=this->data.rfind(' ',end);
+				if ((space!=std::string::npos)&&(space>this->position))
+					end=space;
+				else
+					while ((end>this->position)&&((this->data[end]&0xc0)==0x80)) end--;
+			}
+		}
+		else
+			end++; // include the newline
+
+		std::string slice=this->data.substr(this->position,end-this->position);
+		this->position=end;
+
+		this->pending.erase(0,this->pendingPosition);
+		this->pendingPosition=0;
+		ita2TransliterateString((const uint8_t*)slice.c_str(),text);
+		telexLayoutAppend(text,this->pending,&this->layout);
+		if (this->position>=this->data.length())
+			telexLayoutFinish(this->pending,&this->layout);
+	}
+
+	size_t end=this->pending.find('\n',this->pendingPosition);
+	end=(end==std::string::npos)?this->pending.length():end+1;
+	line.assign(this->pending,this->pendingPosition,end-this->pendingPosition);
+	this->pendingPosition=end;
+	return 1;
+}
+
+uint8_t telexPrintJob::nextChar(uint8_t *c)
+{
+	if (this->linePosition>=this->line.length())
+	{
+		if (!this->nextLine(this->line)) return 0;
+		this->linePosition=0;
+	}
+	*c=this->line[this->linePosition++];
+	return 1;
+}
+
+uint8_t telexPrintJob::done(void)
+{
+	return ((this->position>=this->data.length())&&(this->pendingPosition>=this->pending.length())&&
+	        (this->linePosition>=this->line.length()));
+}
+
+size_t telexPrintJob::remaining(void)
+{
+	return (this->data.length()-this->position)+(this->pending.length()-this->pendingPosition)+
+	       (this->line.length()-this->linePosition);
+}
+
+uint8_t telexPrintJob::append(const telexPrintJob *job)
+{
+	// symbol streams count on starting in a known state, they are not merged
+	if ((job->format!=TELEX_FORMAT_TEXT)||(this->format!=TELEX_FORMAT_TEXT)||(job->priority!=this->priority)||
+	    (job->filter!=this->filter)||(job->color!=this->color))
+		return 0;
+
+	// the separator is a single newline, only needed while the last line has not been laid out yet
+	if ((this->position<this->data.length())&&(this->data[this->data.length()-1]!='\n'))
+		this->data+='\n';
+
+	// input that is laid out already is dropped, so a long run does not grow
+	this->data.erase(0,this->position);
+	size_t kept=0;
+	for (size_t zz=0;zz<this->messages.size();zz++)
+		if (this->messages[zz]>=this->position)
+			this->messages[kept++]=this->messages[zz]-this->position;
+	this->messages.resize(kept);
+	this->position=0;
+
+	this->messages.push_back(this->data.length());
+	this->data+=job->data;
+	return 1;
+}
+
+uint8_t telexPrintJob::skipMessage(void)
+{
+	// messages start right after a newline, so they also start a slice: a message that starts
+	// before the next slice is the one being printed
+	size_t zz=0;
+	while ((zz<this->messages.size())&&(this->messages[zz]<this->position)) zz++;
+	if (zz>=this->messages.size()) return 0;
+
+	this->position=this->messages[zz];
+	this->pending.clear();
+	this->pendingPosition=0;
+	this->line.clear();
+	this->linePosition=0;
+	telexLayoutInit(&this->layout);
+	return 1;
+}
+
+telexPrinter::telexPrinter(telex *t)
+{
+	this->t=t;
+	this->current=0;
+	this->color=0;
+}
+
+telexPrinter::~telexPrinter()
+{
+	for (size_t zz=0;zz<this->jobs.size();zz++)
+		delete this->jobs[zz];
+}
+
+void telexPrinter::submit(telexPrintJob *job)
+{
+	// append to the newest job of the same priority, unless it has been preempted
+	for (size_t zz=this->jobs.size();zz>0;zz--)
+	{
+		telexPrintJob *last=this->jobs[zz-1];
+		if (last->priority!=job->priority) continue;
+		if (((last->started)&&(last!=this->current))||(!last->append(job))) break;
+		telexLog(TELEX_LOG_DEBUG,TELEX_LOG_GENERAL,"[Message appended to the print run (priority %d)]\n",job->priority);
+		delete job;
+		return;
+	}
+	this->jobs.push_back(job);
+}
+
+uint8_t telexPrinter::printLine(const std::atomic<bool> *interrupt)
+{
+	// highest priority first, the oldest job of that priority first (so a suspended job resumes
+	// before newer jobs of the same priority)
+	telexPrintJob *job=0;
+	size_t index=0;
+	for (size_t zz=0;zz<this->jobs.size();zz++)
+	{
+		if ((!job)||(this->jobs[zz]->priority>job->priority))
+		{
+			job=this->jobs[zz];
+			index=zz;
+		}
+	}
+	if (!job) return 0;
+
+	if (job!=this->current)
+	{
+		if (this->current)
+		{
+			// suspend the current job (at a line boundary, or mid-line after an interrupt)
+			this->current->savedAlphabet=this->t->currentAlphabet;
+			this->current->savedCursorPos=this->t->cursorPos;
+			telexLog(TELEX_LOG_INFO,TELEX_LOG_GENERAL,"[Job (priority %d) preempted by job (priority %d)]\n",this->current->priority,job->priority);
+		}
+		if (job->started)
+		{
+			telexLog(TELEX_LOG_INFO,TELEX_LOG_GENERAL,"[Resuming job (priority %d)]\n",job->priority);
+			this->t->restoreState(job->savedAlphabet,job->savedCursorPos);
+		}
+		else if (job->format==TELEX_FORMAT_ITA2)
+			this->t->restoreState(1,0); // the symbols count on a known state
+		else if (this->t->cursorPos)
+			this->t->sendChar('\n'); // every job starts on a fresh line
+		if (job->color!=this->color)
+		{
+			this->t->setColor(job->color);
+			this->color=job->color;
+		}
+		this->current=job;
+		job->started=1;
+	}
+
+	uint8_t c;
+	while (job->nextChar(&c))
+	{
+		if (job->format==TELEX_FORMAT_ITA2)
+		{
+			this->t->sendRawChar(c);
+			c=telex::alphabet1[c];
+		}
+		else
+			this->t->sendChar(c,job->filter);
+		if ((c=='\n')||((interrupt)&&(*interrupt))) break;
+	}
+
+	if (job->done())
+	{
+		this->jobs.erase(this->jobs.begin()+index);
+		delete job;
+		this->current=0;
+	}
+	return 1;
+}
+
+void telexPrinter::skip(void)
+{
+	if (!this->current) return;
+	if (this->current->skipMessage())
+	{
+		// the rest of the run continues on a fresh line
+		if (this->t->cursorPos)
+			this->t->sendChar('\n');
+		return;
+	}
+	for (size_t zz=0;zz<this->jobs.size();zz++)
+		if (this->jobs[zz]==this->current)
+		{
+			this->jobs.erase(this->jobs.begin()+zz);
+			break;
+		}
+	delete this->current;
+	this->current=0; // the next job starts on a fresh line
+}
+
+size_t telexPrinter::clear(void)
+{
+	size_t count=this->jobs.size();
+	for (size_t zz=0;zz<count;zz++)
+		delete this->jobs[zz];
+	this->jobs.clear();
+	this->current=0;
+	return count;
+}
+
+size_t telexPrinter::pending(void)
+{
+	return this->jobs.size();
+}
+
+size_t telexPrinter::backlog(void)
+{
+	size_t bytes=0;
+	for (size_t zz=0;zz<this->jobs.size();zz++)
+		bytes+=this->jobs[zz]->remaining();
+	return bytes;
+}
+
+int telexPrinter::currentPriority(void)
+{
+	int priority=-1;
+	for (size_t zz=0;zz<this->jobs.size();zz++)
+		if (this->jobs[zz]->priority>priority) priority=this->jobs[zz]->priority;
+	return priority;
+}
@@ -0,0 +1,79 @@
+#ifndef TELEX_PRINTER_H
+#define TELEX_PRINTER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <atomic>
+#include "telex.h"
+#include "telexLayout.h"
+
+// longest piece of input (bytes) transliterated and laid out at once, paragraphs
+// longer than this are split at a word boundary
+#define TELEX_JOB_SLICE 1024
+// the next queued message joins the print run once fewer bytes than this are left to print
+#define TELEX_RUN_AHEAD 256
+
+// a message printed line by line: input is transliterated and laid out incrementally,
+// so any payload size costs the same memory per step and a job can be suspended between lines.
+// An ITA2 job holds symbols (one per byte) that are sent as they are, starting in the letter
+// alphabet on a fresh line.
+class telexPrintJob
+{
+	private:
+		std::string data; // UTF-8 input or ITA2 symbols
+		size_t position; // next input byte to lay out
+		std::string pending; // laid out lines not printed yet
+		size_t pendingPosition;
+		std::string line; // line being printed
+		size_t linePosition;
+		telexLayoutState layout;
+		std::vector<size_t> messages; // input offsets of the messages appended to the run
+
+	public:
+		uint8_t priority;
+		uint8_t filter;
+		uint8_t color; // 0=black 1=red
+		uint8_t format; // TELEX_FORMAT_TEXT or TELEX_FORMAT_ITA2
+		uint8_t started;
+		uint8_t savedAlphabet; // telex state when the job was suspended
+		uint8_t savedCursorPos;
+
+	public:
+		telexPrintJob(const char *data, size_t length, uint8_t priority=TELEX_PRIORITY_NORMAL, uint8_t filter=1, uint8_t color=0,
+		              uint8_t format=TELEX_FORMAT_TEXT);
+		uint8_t nextLine(std::string &line); // next printed line including newline, 0 when done
+		uint8_t nextChar(uint8_t *c); // next character of the current line, 0 when done
+		uint8_t done(void);
+		size_t remaining(void); // bytes not printed yet
+		uint8_t append(const telexPrintJob *job); // continues the run with another message, 0 if incompatible
+		uint8_t skipMessage(void); // moves on to the next appended message, 0 if there is none
+};
+
+// prints jobs one line at a time, highest priority first; a job that is preempted by a
+// higher priority job resumes with its own alphabet and carriage position afterwards.
+// printLine can be interrupted after any character, the job then continues mid-line.
+// A job submitted behind a job of the same priority and color is appended to it, so a backlog
+// prints as one run: one newline between messages and the alphabet carries over.
+class telexPrinter
+{
+	private:
+		telex *t;
+		std::vector<telexPrintJob*> jobs; // in order of submission
+		telexPrintJob *current;
+		uint8_t color; // ribbon color selected on the telex
+
+	public:
+		telexPrinter(telex *t);
+		~telexPrinter();
+		void submit(telexPrintJob *job); // takes ownership, job may be merged and deleted
+		uint8_t printLine(const std::atomic<bool> *interrupt=0); // returns 0 when there was nothing to print
+		void skip(void); // abandons the job being printed
+		size_t clear(void); // abandons all jobs, returns their number
+		size_t pending(void);
+		size_t backlog(void); // bytes left to print in all jobs
+		int currentPriority(void); // -1 when idle
+};
+
+#endif
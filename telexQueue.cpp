@@ -0,0 +1,238 @@
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include "telexQueue.h"
+#include "telexLog.h"
+
+telexQueue::telexQueue(unsigned long maxMessages, size_t budget) : slab(budget)
+{
+	this->maxMessages=maxMessages;
+	this->dropped=0;
+	this->droppedBytes=0;
+	this->expired=0;
+	this->count=0;
+	this->bytes=0;
+	this->totalCost=0;
+}
+
+uint8_t telexQueue::setBudget(size_t budget)
+{
+	return this->slab.resize(budget);
+}
+
+unsigned long telexQueue::estimateCost(const char *data, size_t length)
+{
+	// predicted symbols, estimated in pieces as the payload is not 0 terminated
+	char piece[TELEX_SLAB_CHUNK+1];
+	unsigned long cost=0;
+	uint8_t alphabet=0, cursorPos=0;
+
+	for (size_t offset=0;offset<length;offset+=TELEX_SLAB_CHUNK)
+	{
+		size_t part=(length-offset<TELEX_SLAB_CHUNK)?length-offset:TELEX_SLAB_CHUNK;
+		memcpy(piece,data+offset,part);
+		piece[part]=0;
+		cost+=telex::estimateSymbols((const uint8_t*)piece,1,&alphabet,&cursorPos);
+	}
+	return cost;
+}
+
+void telexQueue::setWeight(const std::string &source, unsigned weight)
+{
+	this->weights[source]=weight?weight:1;
+}
+
+unsigned telexQueue::getWeight(const std::string &source)
+{
+	std::map<std::string,unsigned>::iterator weight=this->weights.find(source);
+	return (weight==this->weights.end())?TELEX_QUEUE_DEFAULT_WEIGHT:weight->second;
+}
+
+uint8_t telexQueue::dropOne(void)
+{
+	// drop from the source with the largest backlog, so the source that floods the queue pays for it
+	uint8_t zz=0;
+	while ((zz<TELEX_PRIORITIES)&&(this->flows[zz].empty())) zz++;
+	if (zz>=TELEX_PRIORITIES) return 0;
+
+	std::map<std::string,telexQueueFlow>::iterator largest=this->flows[zz].begin();
+	for (std::map<std::string,telexQueueFlow>::iterator flow=largest;flow!=this->flows[zz].end();++flow)
+		if (flow->second.cost>largest->second.cost) largest=flow;
+
+	telexQueueEntry &entry=largest->second.messages.front();
+	largest->second.cost-=entry.cost;
+	this->totalCost-=entry.cost;
+	this->slab.release(entry.handle);
+	this->droppedBytes+=entry.length;
+	this->bytes-=entry.length;
+	largest->second.messages.pop_front();
+	this->count--;
+	if (largest->second.messages.empty())
+	{
+		for (std::deque<std::string>::iterator name=this->active[zz].begin();name!=this->active[zz].end();++name)
+			if (*name==largest->first)
+			{
+				this->active[zz].erase(name);
+				break;
+			}
+		this->flows[zz].erase(largest);
+	}
+	return 1;
+}
+
+unsigned long telexQueue::push(const char *data, size_t length, uint8_t priority, const std::string &source, uint8_t color, time_t expires, uint8_t format)
+{
+	// returns the number of messages thrown away to make room
+	unsigned long ntoskip=0;
+	unsigned long long droppedBytes=this->droppedBytes;
+	if (priority>=TELEX_PRIORITIES) priority=TELEX_PRIORITIES-1;
+
+	if (length>this->slab.capacity())
+	{
+		this->dropped++;
+		this->droppedBytes+=length;
+		telexLog(TELEX_LOG_WARNING,TELEX_LOG_MQTT,"I threw away a message of %lu bytes (larger than the buffer)\n",(unsigned long)length);
+		return 1;
+	}
+
+	while (((this->maxMessages)&&(this->count>=this->maxMessages))||(!this->slab.fits(length)))
+	{
+		if (!this->dropOne())
+		{
+			// even the empty queue has no room (no buffer at all): the message goes as well
+			this->dropped+=ntoskip+1;
+			this->droppedBytes+=length;
+			telexLog(TELEX_LOG_WARNING,TELEX_LOG_MQTT,"I threw away a message of %lu bytes (no room in the buffer)\n",(unsigned long)length);
+			return ntoskip+1;
+		}
+		ntoskip++;
+	}
+	if (ntoskip)
+	{
+		this->dropped+=ntoskip;
+		telexLog(TELEX_LOG_WARNING,TELEX_LOG_MQTT,"I threw away %ld items (%llu bytes)\n",ntoskip,this->droppedBytes-droppedBytes);
+	}
+
+	telexQueueFlow &flow=this->flows[priority][source];
+	if (flow.messages.empty())
+	{
+		flow.cost=0;
+		flow.deficit=0;
+		this->active[priority].push_back(source);
+	}
+	flow.messages.push_back(telexQueueEntry());
+	telexQueueEntry &entry=flow.messages.back();
+	entry.handle=this->slab.store(data,length);
+	entry.length=length;
+	entry.color=color;
+	entry.format=format;
+	entry.expires=expires;
+	entry.cost=(format==TELEX_FORMAT_ITA2)?length:estimateCost(data,length); // symbols are sent as they are
+	flow.cost+=entry.cost;
+	this->totalCost+=entry.cost;
+	this->count++;
+	this->bytes+=length;
+	return ntoskip;
+}
+
+void telexQueue::removeFront(uint8_t priority)
+{
+	// removes the first message of the source at the head of the round
+	std::deque<std::string> &round=this->active[priority];
+	telexQueueFlow &flow=this->flows[priority][round.front()];
+	telexQueueEntry &entry=flow.messages.front();
+
+	flow.cost-=entry.cost;
+	this->totalCost-=entry.cost;
+	this->slab.release(entry.handle);
+	this->bytes-=entry.length;
+	flow.messages.pop_front();
+	this->count--;
+	if (flow.messages.empty())
+	{
+		// idle sources do not save up credit
+		this->flows[priority].erase(round.front());
+		round.pop_front();
+	}
+}
+
+uint8_t telexQueue::pop(std::string &message, uint8_t *priority, std::string *source, uint8_t *color, uint8_t *format)
+{
+	time_t now=time(NULL);
+
+	for (;;)
+	{
+		int top=this->topPriority();
+		if (top<0) return 0;
+
+		// deficit round robin: the source at the head of the round may print while its deficit covers
+		// the next message, otherwise it gets its quantum and moves to the end of the round
+		std::deque<std::string> &round=this->active[top];
+		telexQueueFlow &flow=this->flows[top][round.front()];
+		telexQueueEntry &entry=flow.messages.front();
+		if ((entry.expires)&&(now>=entry.expires))
+		{
+			this->expired++;
+			telexLog(TELEX_LOG_INFO,TELEX_LOG_MQTT,"Message from %s expired unprinted\n",round.front().c_str());
+			this->removeFront(top);
+			continue;
+		}
+		if (flow.deficit<entry.cost)
+		{
+			flow.deficit+=TELEX_QUEUE_QUANTUM*this->getWeight(round.front());
+			round.push_back(round.front());
+			round.pop_front();
+			continue;
+		}
+
+		flow.deficit-=entry.cost;
+		this->slab.load(entry.handle,entry.length,message);
+		if (priority) *priority=top;
+		if (source) *source=round.front();
+		if (color) *color=entry.color;
+		if (format) *format=entry.format;
+		this->removeFront(top);
+		return 1;
+	}
+}
+
+size_t telexQueue::clear(void)
+{
+	size_t count=this->count;
+	for (uint8_t zz=0;zz<TELEX_PRIORITIES;zz++)
+		while (!this->active[zz].empty())
+			this->removeFront(zz);
+	return count;
+}
+
+int telexQueue::topPriority(void)
+{
+	for (int zz=TELEX_PRIORITIES-1;zz>=0;zz--)
+		if (!this->active[zz].empty()) return zz;
+	return -1;
+}
+
+size_t telexQueue::size(void)
+{
+	return this->count;
+}
+
+size_t telexQueue::sizeBytes(void)
+{
+	return this->bytes;
+}
+
+unsigned long long telexQueue::cost(void)
+{
+	return this->totalCost;
+}
+
+size_t telexQueue::usedBytes(void)
+{
+	return this->slab.used();
+}
+
+size_t telexQueue::budget(void)
+{
+	return this->slab.capacity();
+}
@@ -0,0 +1,82 @@
+#ifndef TELEX_QUEUE_H
+#define TELEX_QUEUE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+#include <string>
+#include <deque>
+#include <map>
+#include "telex.h"
+#include "telexSlab.h"
+
+// symbols a source with weight 1 may print per deficit round robin round
+#define TELEX_QUEUE_QUANTUM 256
+#define TELEX_QUEUE_DEFAULT_WEIGHT 1
+// bytes of message storage
+#define TELEX_QUEUE_DEFAULT_BUDGET (1<<20)
+
+struct telexQueueEntry
+{
+	uint32_t handle; // message text in the slab
+	size_t length;
+	uint8_t color;
+	uint8_t format; // TELEX_FORMAT_TEXT or TELEX_FORMAT_ITA2 (one symbol per byte)
+	time_t expires; // thrown away unprinted after this time (0=never)
+	unsigned long cost; // predicted number of printed symbols
+};
+
+// messages of one source (topic or publisher)
+struct telexQueueFlow
+{
+	std::deque<telexQueueEntry> messages;
+	unsigned long cost; // predicted symbols of all queued messages
+	unsigned long deficit; // symbols this source may still print in the current round
+};
+
+// messages waiting to be printed, highest priority first; within a priority the sources are
+// served by deficit round robin on the predicted print time (symbols), weighted per source,
+// so a source that publishes a lot cannot starve the others.
+// Message text is kept in a preallocated slab with a byte budget. When the queue is full (messages
+// or bytes) the oldest message of the source with the largest backlog (lowest priority first) is
+// thrown away.
+class telexQueue
+{
+	private:
+		std::map<std::string,telexQueueFlow> flows[TELEX_PRIORITIES];
+		std::deque<std::string> active[TELEX_PRIORITIES]; // round robin order of sources with messages
+		std::map<std::string,unsigned> weights;
+		telexSlab slab;
+		size_t count;
+		size_t bytes;
+		unsigned long long totalCost;
+
+	private:
+		unsigned getWeight(const std::string &source);
+		uint8_t dropOne(void); // returns 0 when the queue is empty
+		void removeFront(uint8_t priority);
+		static unsigned long estimateCost(const char *data, size_t length);
+
+	public:
+		unsigned long maxMessages;
+		unsigned long dropped; // total number of messages thrown away
+		unsigned long long droppedBytes;
+		unsigned long expired; // messages whose time to live ran out before they were printed
+
+	public:
+		telexQueue(unsigned long maxMessages=10, size_t budget=TELEX_QUEUE_DEFAULT_BUDGET);
+		uint8_t setBudget(size_t budget); // only while the queue is empty
+		void setWeight(const std::string &source, unsigned weight);
+		unsigned long push(const char *data, size_t length, uint8_t priority=TELEX_PRIORITY_NORMAL, const std::string &source="",
+		                   uint8_t color=0, time_t expires=0, uint8_t format=TELEX_FORMAT_TEXT);
+		uint8_t pop(std::string &message, uint8_t *priority=0, std::string *source=0, uint8_t *color=0, uint8_t *format=0);
+		size_t clear(void); // throws every message away, returns their number
+		int topPriority(void); // -1 when empty
+		size_t size(void);
+		size_t sizeBytes(void);
+		size_t usedBytes(void); // buffer in use, in whole chunks (what the budget is counted in)
+		unsigned long long cost(void); // predicted symbols of all queued messages
+		size_t budget(void);
+};
+
+#endif
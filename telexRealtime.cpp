@@ -0,0 +1,115 @@
+#include <errno.h>
+#include <malloc.h>
+#include <pthread.h>
+#include <sched.h>
+#include <string.h>
+#include <time.h>
+#include <sys/mman.h>
+#include "telexRealtime.h"
+#include "telexLog.h"
+
+static void prefaultStack(void)
+{
+	// touch the stack the timing code may need, so it is mapped (and locked) before the first bit
+	volatile uint8_t stack[TELEX_RT_STACK_PREFAULT];
+	for (size_t zz=0;zz<sizeof(stack);zz+=4096)
+		stack[zz]=0;
+}
+
+uint8_t telexRealtimeStart(int cpu, int priority)
+{
+	uint8_t ok=1;
+
+	// freed heap stays in the process (no trim, no mmap per allocation), so it stays locked and mapped
+	mallopt(M_TRIM_THRESHOLD,-1);
+	mallopt(M_MMAP_MAX,0);
+	if (mlockall(MCL_CURRENT|MCL_FUTURE))
+	{
+		telexLog(TELEX_LOG_WARNING,TELEX_LOG_GENERAL,"[Real-time: unable to lock memory (%s)]\n",strerror(errno));
+		ok=0;
+	}
+	prefaultStack();
+
+	if (cpu>=0)
+	{
+		cpu_set_t cpus;
+		CPU_ZERO(&cpus);
+		CPU_SET(cpu,&cpus);
+		int res=pthread_setaffinity_np(pthread_self(),sizeof(cpus),&cpus);
+		if (res)
+		{
+			telexLog(TELEX_LOG_WARNING,TELEX_LOG_GENERAL,"[Real-time: unable to pin to CPU %d (%s)]\n",cpu,strerror(res));
+			ok=0;
+		}
+	}
+
+	struct sched_param param;
+	memset(&param,0,sizeof(param));
+	param.sched_priority=priority;
+	int res=pthread_setschedparam(pthread_self(),SCHED_FIFO,&param);
+	if (res)
+	{
+		telexLog(TELEX_LOG_WARNING,TELEX_LOG_GENERAL,"[Real-time: unable to switch to SCHED_FIFO (%s)]\n",strerror(res));
+		ok=0;
+	}
+	if (ok)
+		telexLog(TELEX_LOG_INFO,TELEX_LOG_GENERAL,"[Real-time: SCHED_FIFO priority %d, CPU %d, memory locked]\n",priority,cpu);
+	return ok;
+}
+
+telexRealtimeMutex::telexRealtimeMutex()
+{
+	pthread_mutexattr_t attr;
+	pthread_mutexattr_init(&attr);
+	pthread_mutexattr_setprotocol(&attr,PTHREAD_PRIO_INHERIT);
+	pthread_mutex_init(&this->mutex,&attr);
+	pthread_mutexattr_destroy(&attr);
+}
+
+telexRealtimeMutex::~telexRealtimeMutex()
+{
+	pthread_mutex_destroy(&this->mutex);
+}
+
+void telexRealtimeMutex::lock(void)
+{
+	pthread_mutex_lock(&this->mutex);
+}
+
+void telexRealtimeMutex::unlock(void)
+{
+	pthread_mutex_unlock(&this->mutex);
+}
+
+bool telexRealtimeMutex::try_lock(void)
+{
+	return pthread_mutex_trylock(&this->mutex)==0;
+}
+
+void telexJitterTest(unsigned long period, unsigned long samples, unsigned long limit, telexJitterStats *stats)
+{
+	struct timespec deadline, now;
+	unsigned long long total=0;
+
+	memset(stats,0,sizeof(*stats));
+	clock_gettime(CLOCK_MONOTONIC,&deadline);
+	for (unsigned long zz=0;zz<samples;zz++)
+	{
+		deadline.tv_nsec+=period*1000;
+		while (deadline.tv_nsec>=1000000000L)
+		{
+			deadline.tv_nsec-=1000000000L;
+			deadline.tv_sec++;
+		}
+		while (clock_nanosleep(CLOCK_MONOTONIC,TIMER_ABSTIME,&deadline,NULL)==EINTR);
+		clock_gettime(CLOCK_MONOTONIC,&now);
+
+		long long latency=((long long)(now.tv_sec-deadline.tv_sec)*1000000000LL+(now.tv_nsec-deadline.tv_nsec))/1000;
+		if (latency<0) latency=0;
+		total+=latency;
+		if ((unsigned long)latency>stats->maxLatency) stats->maxLatency=latency;
+		if ((unsigned long)latency>limit) stats->late++;
+		stats->samples++;
+	}
+	stats->meanLatency=samples?(double)total/samples:0;
+}
@@ -0,0 +1,47 @@
+#ifndef TELEX_REALTIME_H
+#define TELEX_REALTIME_H
+
+#include <stdint.h>
+#include <pthread.h>
+
+// Opt-in real-time mode for the thread that times the bits: SCHED_FIFO on a pinned core with
+// all memory locked and prefaulted, so other services on the board (or a page fault) can not
+// stretch a bit. Needs root (or CAP_SYS_NICE and CAP_IPC_LOCK). Start threads that should keep
+// normal priority (network, log) before calling telexRealtimeStart, new threads inherit it.
+
+#define TELEX_RT_PRIORITY 80 // above the interrupt threads of PREEMPT_RT kernels (50), below the watchdogs (99)
+#define TELEX_RT_STACK_PREFAULT (256*1024) // bytes of stack touched in advance
+
+struct telexJitterStats
+{
+	unsigned long samples;
+	double meanLatency; // micro seconds a wakeup came after its deadline
+	unsigned long maxLatency; // micro seconds, worst case
+	unsigned long late; // wakeups later than the limit
+};
+
+// Mutex with priority inheritance, for data the real-time thread shares with normal threads: the
+// holder runs at the priority of the highest waiter, so a preempted normal thread can not hold up
+// the real-time thread (std::mutex has no protocol attribute). Works with std::lock_guard,
+// std::unique_lock and std::condition_variable_any.
+class telexRealtimeMutex
+{
+	private:
+		pthread_mutex_t mutex;
+
+	public:
+		telexRealtimeMutex();
+		~telexRealtimeMutex();
+		void lock(void);
+		void unlock(void);
+		bool try_lock(void);
+};
+
+// switches the calling thread to SCHED_FIFO (cpu<0: no pinning), returns 0 when a step failed
+uint8_t telexRealtimeStart(int cpu, int priority=TELEX_RT_PRIORITY);
+
+// sleeps to samples absolute deadlines period micro seconds apart (as the bit timing does) and
+// measures how late each wakeup is
+void telexJitterTest(unsigned long period, unsigned long samples, unsigned long limit, telexJitterStats *stats);
+
+#endif
@@ -0,0 +1,95 @@
+#include <string.h>
+#include "telexSlab.h"
+
+telexSlab::telexSlab(size_t budget)
+{
+	this->arena=0;
+	this->next=0;
+	this->resize(budget);
+}
+
+telexSlab::~telexSlab()
+{
+	delete[] this->arena;
+	delete[] this->next;
+}
+
+uint8_t telexSlab::resize(size_t budget)
+{
+	if ((this->arena)&&(this->freeChunks!=this->chunks)) return 0;
+
+	delete[] this->arena;
+	delete[] this->next;
+	this->chunks=budget/TELEX_SLAB_CHUNK;
+	this->arena=new char[(size_t)this->chunks*TELEX_SLAB_CHUNK];
+	this->next=new uint32_t[this->chunks];
+	memset(this->arena,0,(size_t)this->chunks*TELEX_SLAB_CHUNK); // fault the pages in now, not on the receive path
+
+	this->freeList=this->chunks?0:TELEX_SLAB_NONE;
+	for (uint32_t zz=0;zz<this->chunks;zz++)
+		this->next[zz]=(zz+1<this->chunks)?zz+1:TELEX_SLAB_NONE;
+	this->freeChunks=this->chunks;
+	return 1;
+}
+
+uint8_t telexSlab::fits(size_t length)
+{
+	size_t needed=length?(length+TELEX_SLAB_CHUNK-1)/TELEX_SLAB_CHUNK:1;
+	return (needed<=this->freeChunks);
+}
+
+uint32_t telexSlab::store(const char *data, size_t length)
+{
+	// an empty message still takes one chunk, so every stored message has a valid handle
+	size_t needed=length?(length+TELEX_SLAB_CHUNK-1)/TELEX_SLAB_CHUNK:1;
+	if (needed>this->freeChunks) return TELEX_SLAB_NONE;
+
+	uint32_t handle=this->freeList, chunk=handle, last=handle;
+	for (size_t offset=0;needed--;offset+=TELEX_SLAB_CHUNK)
+	{
+		size_t part=(length-offset<TELEX_SLAB_CHUNK)?length-offset:TELEX_SLAB_CHUNK;
+		memcpy(this->arena+(size_t)chunk*TELEX_SLAB_CHUNK,data+offset,part);
+		last=chunk;
+		chunk=this->next[chunk];
+		this->freeChunks--;
+	}
+	this->freeList=chunk;
+	this->next[last]=TELEX_SLAB_NONE;
+	return handle;
+}
+
+void telexSlab::load(uint32_t handle, size_t length, std::string &out)
+{
+	out.resize(length);
+	for (size_t offset=0;offset<length;offset+=TELEX_SLAB_CHUNK)
+	{
+		size_t part=(length-offset<TELEX_SLAB_CHUNK)?length-offset:TELEX_SLAB_CHUNK;
+		memcpy(&out[offset],this->arena+(size_t)handle*TELEX_SLAB_CHUNK,part);
+		handle=this->next[handle];
+	}
+}
+
+void telexSlab::release(uint32_t handle)
+{
+	if (handle==TELEX_SLAB_NONE) return;
+
+	uint32_t last=handle;
+	this->freeChunks++;
+	while (this->next[last]!=TELEX_SLAB_NONE)
+	{
+		last=this->next[last];
+		this->freeChunks++;
+	}
+	this->next[last]=this->freeList;
+	this->freeList=handle;
+}
+
+size_t telexSlab::capacity(void)
+{
+	return (size_t)this->chunks*TELEX_SLAB_CHUNK;
+}
+
+size_t telexSlab::used(void)
+{
+	return (size_t)(this->chunks-this->freeChunks)*TELEX_SLAB_CHUNK;
+}
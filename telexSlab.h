@@ -0,0 +1,35 @@
+#ifndef TELEX_SLAB_H
+#define TELEX_SLAB_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+
+// Message storage in one preallocated arena of fixed-size chunks: a message is a chain of chunks,
+// so memory use is bounded by the budget and does not fragment whatever the payload sizes are.
+
+#define TELEX_SLAB_CHUNK 256
+#define TELEX_SLAB_NONE 0xffffffff // no chunk / invalid handle
+
+class telexSlab
+{
+	private:
+		char *arena;
+		uint32_t *next; // next chunk of a message, or of the free list
+		uint32_t chunks;
+		uint32_t freeList;
+		uint32_t freeChunks;
+
+	public:
+		telexSlab(size_t budget); // rounded down to whole chunks
+		~telexSlab();
+		uint8_t resize(size_t budget); // only while nothing is stored
+		uint32_t store(const char *data, size_t length); // TELEX_SLAB_NONE when it does not fit
+		void load(uint32_t handle, size_t length, std::string &out);
+		void release(uint32_t handle);
+		uint8_t fits(size_t length);
+		size_t capacity(void); // bytes
+		size_t used(void); // bytes in use, including the unused tails of chunks
+};
+
+#endif
@@ -0,0 +1,124 @@
+#include <stdlib.h>
+#include "telexTranslit.h"
+
+// UTF-8 to ITA2 transliteration
+// Replacements only use characters that are in alphabet1 / alphabet2 (letters are lowercase as the
+// telex has no case), so every code point costs as few printed symbols and alphabet switches as possible.
+
+#define UTF8_REPLACEMENT 0xfffd
+
+// U+00A0 .. U+017F (Latin-1 supplement and Latin extended-A)
+#define TRANSLIT_LATIN_FIRST 0x00a0
+#define TRANSLIT_LATIN_LAST 0x017f
+
+static const char *translitLatin[TRANSLIT_LATIN_LAST-TRANSLIT_LATIN_FIRST+1]={
+	" ","","c","gbp","+","yen","/","par", // U+00A0
+	"","(c)","a","'","-","","(r)","-", // U+00A8
+	"o","+-","2","3","'","u","par",".", // U+00B0
+	",","1","o","'","1/4","1/2","3/4","?", // U+00B8
+	"a","a","a","a","ae","aa","ae","c", // U+00C0
+	"e","e","e","e","i","i","i","i", // U+00C8
+	"d","n","o","o","o","o","oe","x", // U+00D0
+	"oe","u","u","u","ue","y","th","ss", // U+00D8
+	"a","a","a","a","ae","aa","ae","c", // U+00E0
+	"e","e","e","e","i","i","i","i", // U+00E8
+	"d","n","o","o","o","o","oe","/", // U+00F0
+	"oe","u","u","u","ue","y","th","y", // U+00F8
+	"a","a","a","a","a","a","c","c", // U+0100
+	"c","c","c","c","c","c","d","d", // U+0108
+	"d","d","e","e","e","e","e","e", // U+0110
+	"e","e","e","e","g","g","g","g", // U+0118
+	"g","g","g","g","h","h","h","h", // U+0120
+	"i","i","i","i","i","i","i","i", // U+0128
+	"i","i","ij","ij","j","j","k","k", // U+0130
+	"k","l","l","l","l","l","l","l", // U+0138
+	"l","l","l","n","n","n","n","n", // U+0140
+	"n","n","n","n","o","o","o","o", // U+0148
+	"o","o","oe","oe","r","r","r","r", // U+0150
+	"r","r","s","s","s","s","s","s", // U+0158
+	"s","s","t","t","t","t","t","t", // U+0160
+	"u","u","u","u","u","u","u","u", // U+0168
+	"u","u","u","u","w","w","y","y", // U+0170
+	"y","z","z","z","z","z","z","s", // U+0178
+};
+
+struct translitEntry
+{
+	uint32_t codePoint;
+	const char *ascii;
+};
+
+// sparse table for punctuation and symbols, must be sorted on code point (binary search)
+static const translitEntry translitSymbols[]={
+	{0x02bc,"'"},{0x02c6,""},{0x02dc,""},
+	{0x2000," "},{0x2001," "},{0x2002," "},{0x2003," "},{0x2004," "},{0x2005," "},{0x2006," "},
+	{0x2007," "},{0x2008," "},{0x2009," "},{0x200a," "},{0x200b,""},{0x200c,""},{0x200d,""},
+	{0x2010,"-"},{0x2011,"-"},{0x2012,"-"},{0x2013,"-"},{0x2014,"-"},{0x2015,"-"},
+	{0x2018,"'"},{0x2019,"'"},{0x201a,","},{0x201b,"'"},{0x201c,"'"},{0x201d,"'"},{0x201e,"'"},{0x201f,"'"},
+	{0x2022,"-"},{0x2024,"."},{0x2025,".."},{0x2026,"..."},{0x202f," "},
+	{0x2032,"'"},{0x2033,"'"},{0x2039,"'"},{0x203a,"'"},{0x2044,"/"},{0x205f," "},
+	{0x20ac,"eur"},{0x2116,"no"},{0x2122,"tm"},
+	{0x2190,"(left)"},{0x2192,"(right)"},{0x2212,"-"},{0x2215,"/"},{0x2219,"."},{0x2248,"="},
+	{0x3000," "},{0xfeff,""}
+};
+
+uint32_t utf8Decode(const uint8_t *data, uint8_t *len)
+{
+	uint32_t codePoint;
+	uint8_t follow;
+
+	if (data[0]<0x80) { *len=1; return data[0]; }
+	else if ((data[0]&0xe0)==0xc0) { codePoint=data[0]&0x1f; follow=1; }
+	else if ((data[0]&0xf0)==0xe0) { codePoint=data[0]&0x0f; follow=2; }
+	else if ((data[0]&0xf8)==0xf0) { codePoint=data[0]&0x07; follow=3; }
+	else { *len=1; return UTF8_REPLACEMENT; } // stray continuation byte or invalid lead byte
+
+	for (uint8_t zz=1;zz<=follow;zz++)
+	{
+		if ((data[zz]&0xc0)!=0x80) { *len=1; return UTF8_REPLACEMENT; } // truncated sequence (also stops at 0 terminator)
+		codePoint=(codePoint<<6)|(data[zz]&0x3f);
+	}
+	*len=follow+1;
+
+	// reject overlong encodings, surrogates and out of range values
+	if ((follow==1&&codePoint<0x80)||(follow==2&&codePoint<0x800)||(follow==3&&codePoint<0x10000)||
+	    (codePoint>=0xd800&&codePoint<=0xdfff)||(codePoint>0x10ffff))
+		return UTF8_REPLACEMENT;
+	return codePoint;
+}
+
+static int compareTranslitEntry(const void *key, const void *entry)
+{
+	uint32_t codePoint=*(const uint32_t *)key;
+	uint32_t other=((const translitEntry *)entry)->codePoint;
+	return (codePoint<other)?-1:(codePoint>other)?1:0;
+}
+
+const char *ita2Transliterate(uint32_t codePoint)
+{
+	if ((codePoint>=TRANSLIT_LATIN_FIRST)&&(codePoint<=TRANSLIT_LATIN_LAST))
+		return translitLatin[codePoint-TRANSLIT_LATIN_FIRST];
+
+	const translitEntry *entry=(const translitEntry *)bsearch(&codePoint,translitSymbols,
+		sizeof(translitSymbols)/sizeof(translitSymbols[0]),sizeof(translitSymbols[0]),compareTranslitEntry);
+	return entry?entry->ascii:0;
+}
+
+void ita2TransliterateString(const uint8_t *data, std::string &out)
+{
+	out.clear();
+	while (*data)
+	{
+		uint8_t len;
+		uint32_t codePoint=utf8Decode(data,&len);
+		if (codePoint<0x80)
+			out+=(char)codePoint;
+		else
+		{
+			const char *ascii=ita2Transliterate(codePoint);
+			if (ascii) out+=ascii;
+			else out+=TRANSLIT_PLACEHOLDER;
+		}
+		data+=len;
+	}
+}
@@ -0,0 +1,21 @@
+#ifndef TELEX_TRANSLIT_H
+#define TELEX_TRANSLIT_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+
+// character printed for code points that have no ITA2 representation
+#define TRANSLIT_PLACEHOLDER '+'
+
+// decode one UTF-8 sequence, returns the code point and stores the number of bytes used in *len
+// malformed sequences return U+FFFD and consume a single byte
+uint32_t utf8Decode(const uint8_t *data, uint8_t *len);
+
+// returns the ASCII replacement for a code point (may be empty to drop it) or 0 if it can not be mapped
+const char *ita2Transliterate(uint32_t codePoint);
+
+// transliterates a zero terminated UTF-8 string to ASCII
+void ita2TransliterateString(const uint8_t *data, std::string &out);
+
+#endif
@@ -0,0 +1,353 @@
+#include "telex.h"
+#include "telexLog.h"
+#include "telexClient.h"
+#include "telexRealtime.h"
+#include <getopt.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <time.h>
+#include <string.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <sys/stat.h>
+#include <string>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <chrono>
+
+// Telex daemon: owns the GPIO pins and runs print, read and power jobs from clients (telexCtrl)
+// on a Unix domain socket. The printer stays powered between jobs until the power timeout expires,
+// so back-to-back jobs do not pay the power up / power down delays.
+
+#define JOB_PRINT 1
+#define JOB_POWER 2
+#define JOB_READ 3
+
+#define CLIENT_TIMEOUT 5 // seconds a client may stay silent while sending its job
+#define MAX_JOBS 64 // print jobs beyond these limits are rejected
+#define MAX_JOB_BYTES (4*TELEX_JOB_MAX_LENGTH)
+
+struct telexJob
+{
+	uint8_t type;
+	uint8_t filter; // print
+	std::string data; // print
+	uint8_t power; // power
+	uint16_t number; // read: number of characters (0=until timeout)
+	uint8_t timeout; // read: seconds to wait for next character
+	uint8_t echo; // read: local echo
+	int fd; // read: client connection, answered when the job is done
+};
+
+static void print_usage(const char *prog)
+{
+	printf("Teleprinter (Teletype,Telex) daemon for Raspberry Pi, accepts jobs from telexCtrl.\n");
+	printf("Usage: %s [-StlBCvRh]\n", prog);
+	puts("  -S --socket path of the job socket (default " TELEX_SOCKET_PATH ")\n"
+       "  -t --timeout number of seconds without jobs before power is cut (default 10 seconds)\n"
+       "  -l --legacy use this option for enabling legacy IO-mapping (Rapberry Pi 1 and Zero)\n"
+       "  -B --baud baud rate: 45.45, 50 (default), 75 or 100\n"
+       "  -C --calfile calibration file (default " TELEX_CALIBRATION_FILE ")\n"
+       "  -v --verbosity log level 0=error 1=warning 2=info 3=debug 4=trace\n"
+       "  -R --realtime real-time bit timing on this CPU core (-1: any core): SCHED_FIFO, locked memory\n"
+       "  -h --help display this message");
+	exit(1);
+}
+
+const char *socketPath=TELEX_SOCKET_PATH;
+uint8_t legacy=0; // use legacy IO mapping (Raspberry Pi 1 & Zero)
+uint8_t timeout=10;
+const char *baudrate="50";
+const char *calfile=TELEX_CALIBRATION_FILE;
+int realtime=-2; // CPU core of the job thread, -2 = no real-time mode
+
+static void parse_opts(int argc, char *argv[])
+{
+	static const struct option lopts[] = {
+		{ "socket", required_argument, 0, 'S' },
+		{ "timeout", required_argument, 0, 't' },
+    { "legacy", no_argument, 0, 'l' },
+    { "baud", required_argument, 0, 'B' },
+    { "calfile", required_argument, 0, 'C' },
+    { "verbosity", required_argument, 0, 'v' },
+    { "realtime", required_argument, 0, 'R' },
+    { "help", no_argument, 0, 'h' },
+		{ NULL, 0, 0, 0 }
+	};
+
+	int c;
+
+	while ((c=getopt_long(argc, argv, "S:t:lB:C:v:R:h", lopts, NULL))!=-1)
+	{
+		switch (c)
+		{
+			case 'S':
+				socketPath=optarg;
+				break;
+			case 't':
+				timeout=abs(atoi(optarg));
+				break;
+      case 'l':
+				legacy=1;
+				break;
+      case 'B':
+				baudrate=optarg;
+				break;
+      case 'C':
+				calfile=optarg;
+				break;
+      case 'v':
+				telexLogSetLevel(atoi(optarg));
+				break;
+      case 'R':
+				realtime=atoi(optarg);
+				if (realtime<0) realtime=-1;
+				break;
+			case 'h':
+			default:
+				print_usage(argv[0]);
+		}
+	}
+}
+
+telex *t=0;
+int listenFd=-1;
+std::deque<telexJob> jobs;
+size_t jobBytes=0; // text of the queued print jobs
+telexRealtimeMutex jobsLock; // shared with the job thread, which may run real-time
+std::condition_variable_any jobsReady;
+
+static void reply(int fd, const char *line)
+{
+	telexWriteAll(fd,line,strlen(line));
+}
+
+static void handle_client(int fd)
+{
+	// read one job request, print and power jobs are answered as soon as they are queued
+	char line[TELEX_JOB_LINE_SIZE];
+	char command[16];
+	telexJob job;
+	unsigned long length;
+	int a,b,c;
+
+	job.fd=-1;
+	if ((!telexReadLine(fd,line,sizeof(line)))||(sscanf(line,"%15s",command)!=1))
+	{
+		close(fd);
+		return;
+	}
+
+	if ((!strcmp(command,"PRINT"))&&(sscanf(line,"%*s %d %lu",&a,&length)==2))
+	{
+		if (length>TELEX_JOB_MAX_LENGTH)
+		{
+			reply(fd,"ERR job too large\n");
+			close(fd);
+			return;
+		}
+		job.type=JOB_PRINT;
+		job.filter=a;
+		job.data.resize(length);
+		size_t received=0;
+		while (received<length)
+		{
+			ssize_t n=read(fd,&job.data[received],length-received);
+			if (n<=0) break;
+			received+=n;
+		}
+		if (received<length)
+		{
+			close(fd);
+			return;
+		}
+	}
+	else if ((!strcmp(command,"POWER"))&&(sscanf(line,"%*s %d",&a)==1))
+	{
+		job.type=JOB_POWER;
+		job.power=(a!=0);
+	}
+	else if ((!strcmp(command,"READ"))&&(sscanf(line,"%*s %d %d %d",&a,&b,&c)==3))
+	{
+		job.type=JOB_READ;
+		job.number=a;
+		job.timeout=b;
+		job.echo=c;
+		job.fd=fd; // kept open to stream the characters back
+	}
+	else
+	{
+		reply(fd,"ERR unknown job\n");
+		close(fd);
+		return;
+	}
+
+	size_t queued;
+	{
+		std::lock_guard<telexRealtimeMutex> guard(jobsLock);
+		if ((job.type==JOB_PRINT)&&((jobs.size()>=MAX_JOBS)||(jobBytes+job.data.length()>MAX_JOB_BYTES)))
+		{
+			reply(fd,TELEX_QUEUE_FULL "\n");
+			close(fd);
+			return;
+		}
+		jobBytes+=job.data.length();
+		jobs.push_back(job);
+		queued=jobs.size();
+	}
+	jobsReady.notify_one();
+
+	if (job.type!=JOB_READ)
+	{
+		snprintf(line,sizeof(line),"OK queued (%lu jobs)\n",(unsigned long)queued);
+		reply(fd,line);
+		close(fd);
+	}
+}
+
+static void accept_loop(void)
+{
+	for (;;)
+	{
+		int fd=accept(listenFd,NULL,NULL);
+		if (fd<0) continue;
+		// jobs are read one client at a time, a client that stops sending must not block the others
+		struct timeval timeout;
+		timeout.tv_sec=CLIENT_TIMEOUT;
+		timeout.tv_usec=0;
+		setsockopt(fd,SOL_SOCKET,SO_RCVTIMEO,&timeout,sizeof(timeout));
+		handle_client(fd);
+	}
+}
+
+static void run_read_job(telexJob &job)
+{
+	char line[TELEX_JOB_LINE_SIZE];
+	int keyStrokeCounter=0;
+
+	telexLog(TELEX_LOG_INFO,TELEX_LOG_GENERAL,"Listening for keyboard input\n");
+	if (!t->getPower()) t->setPower(1);
+	t->setPowerTimout();
+	do
+	{
+		if (t->detectStartBit())
+		{
+			keyStrokeCounter++;
+			uint8_t data=t->receiveChar(job.echo);
+			snprintf(line,sizeof(line),"DATA %u\n",data); // as a number: a line feed would end the line
+			reply(job.fd,line);
+			if (data=='$')
+				break;
+		}
+		usleep(100);
+	}
+	while (((!job.number)||(keyStrokeCounter<job.number))&&(difftime(time(NULL),t->powerState)<job.timeout));
+
+	snprintf(line,sizeof(line),"OK %d characters\n",keyStrokeCounter);
+	reply(job.fd,line);
+	close(job.fd);
+}
+
+static void run_job(telexJob &job)
+{
+	switch(job.type)
+	{
+		case JOB_PRINT:
+			telexLog(TELEX_LOG_INFO,TELEX_LOG_GENERAL,"Print job (%lu characters)\n",(unsigned long)job.data.length());
+			t->sendString((uint8_t*)job.data.c_str(),job.filter);
+			break;
+		case JOB_POWER:
+			telexLog(TELEX_LOG_INFO,TELEX_LOG_POWER,"Power job (%s)\n",job.power?"on":"off");
+			if (job.power!=t->getPower()) t->setPower(job.power);
+			break;
+		case JOB_READ:
+			run_read_job(job);
+			break;
+	}
+}
+
+void cleanup_resources()
+{
+	if (listenFd>=0) unlink(socketPath);
+	if ((t)&&(t->getPower())) t->setPower(0);
+}
+
+void handle_signal(int x)
+{
+	exit(x); // -> calls cleanup via atexit
+}
+
+int main(int argc, char **argv)
+{
+	parse_opts(argc, argv);
+
+	telexLogStart();
+	atexit(telexLogStop); // runs after cleanup_resources
+	atexit(cleanup_resources);
+	signal(SIGINT, handle_signal);
+	signal(SIGTERM, handle_signal);
+	signal(SIGPIPE, SIG_IGN); // clients may go away while a read job is running
+
+	t=new telex(17,18,27,22,legacy,timeout);
+	if (!t->setBaudrate(baudrate))
+	{
+		printf("Invalid parameters: unsupported baud rate %s\n",baudrate);
+		return 1;
+	}
+	if (t->loadCalibration(calfile))
+		telexLog(TELEX_LOG_INFO,TELEX_LOG_GENERAL,"Using calibrated stop time of %ld us\n",t->stopTime);
+
+	struct sockaddr_un address;
+	if (strlen(socketPath)>=sizeof(address.sun_path))
+	{
+		printf("Socket path too long: %s\n",socketPath);
+		return 1;
+	}
+	memset(&address,0,sizeof(address));
+	address.sun_family=AF_UNIX;
+	strcpy(address.sun_path,socketPath);
+	unlink(socketPath); // stale socket of a previous run
+	if (((listenFd=socket(AF_UNIX,SOCK_STREAM,0))<0)||
+	    (bind(listenFd,(struct sockaddr *)&address,sizeof(address))<0)||
+	    (listen(listenFd,16)<0))
+	{
+		perror("Unable to open job socket");
+		return 1;
+	}
+	chmod(socketPath,0660);
+	telexLog(TELEX_LOG_INFO,TELEX_LOG_GENERAL,"Waiting for jobs on %s\n",socketPath);
+
+	std::thread acceptor(accept_loop);
+	acceptor.detach();
+	if (realtime>-2)
+		telexRealtimeStart(realtime); // only this thread runs jobs, the acceptor keeps its priority
+
+	for (;;)
+	{
+		telexJob job;
+		{
+			std::unique_lock<telexRealtimeMutex> guard(jobsLock);
+			while (jobs.empty())
+			{
+				// keep the printer warm between jobs until the power timeout expires
+				jobsReady.wait_for(guard,std::chrono::seconds(1));
+				if (jobs.empty())
+				{
+					guard.unlock();
+					t->checkPowerTimeout();
+					guard.lock();
+				}
+			}
+			job=jobs.front();
+			jobs.pop_front();
+			jobBytes-=job.data.length();
+		}
+		run_job(job);
+	}
+}
@@ -16,10 +16,19 @@
  */
 
 #include "telex.h"
+#include "telexLog.h"
+#include "telexQueue.h"
+#include "telexPrinter.h"
+#include "telexEnvelope.h"
+#include "telexFilter.h"
+#include "telexCapture.h"
+#include "telexRealtime.h"
 #include <getopt.h>
 #include <stdlib.h>
 #include <stdint.h>
 #include <stdbool.h>
+#include <limits.h>
+#include <errno.h>
 #include <stdio.h>
 #include <signal.h>
 #include <unistd.h>
@@ -29,6 +38,11 @@
 #include <err.h>
 #include <string>
 #include <ctime>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <condition_variable>
+#include <chrono>
 
 #include<bits/stdc++.h>
 using namespace std;
@@ -44,7 +58,7 @@ using namespace std;
  * disconnect, free its resources, and exit. */
 
 #ifdef DEBUG
-#define LOG(...) do { printf(__VA_ARGS__); } while (0)
+#define LOG(...) telexLog(TELEX_LOG_DEBUG, TELEX_LOG_MQTT, __VA_ARGS__)
 #else
 #define LOG(...)
 #endif
@@ -58,14 +72,45 @@ using namespace std;
 #define BROKER_PORT 1883
 
 #define TELEX_INCOMING_FROM_SAT "telex/incoming-sat"
+#define TELEX_INCOMING_FROM_SAT_ALL "telex/incoming-sat/#"
+#define TELEX_INCOMING_ALERT "telex/incoming-alert"
+#define TELEX_INCOMING_ITA2 "telex/incoming-ita2"
+#define TELEX_INCOMING_ITA2_ALL "telex/incoming-ita2/#"
+#define TELEX_CONTROL "telex/control/"
 #define TELEX_CONTROL_ALL "telex/control/all"
 #define TELEX_CONTROL_PID "telex/control/%d"
+#define TELEX_CONTROL_ID "telex/control/%s"
+#define TELEX_CONTROL_REPLY "telex/control/reply/%s"
+#define TELEX_SHARED_PREFIX "$share/%s/"
+#define TELEX_CAPACITY "telex/capacity/%s"
+#define TELEX_STATUS "telex/status/%s"
+
+/* Seconds between two capacity announcements. */
+#define CAPACITY_INTERVAL 10
+/* Milliseconds between two checks of the status (it is only republished when it changes). */
+#define STATUS_POLL_MS 100
+
+/* Queue fill levels (fraction of messages or bytes, whichever is fuller) at which the gateway
+ * stops accepting (starts shedding) and accepts again. */
+#define STATUS_HIGH_WATER 0.8
+#define STATUS_LOW_WATER 0.5
+/* The status is also republished when the fill level crosses one of this many steps. */
+#define STATUS_LEVELS 4
 
 #define SIM_BAUDRATE 7    // 7 characters / second
 
+/* Bytes of a control command echoed in its reply. */
+#define CONTROL_ECHO_BYTES 32
+
+/* Most receive/queue log lines per second, the full payload is logged on every receive. */
+#define MQTT_LOG_RATE_LIMIT 20
+
 struct client_info {
     struct mosquitto *m;
     pid_t pid;
+    char id[HOST_NAME_MAX + 32]; /* client id, unique across hosts */
+    char host[HOST_NAME_MAX + 1];
+    char node[HOST_NAME_MAX + 1]; /* stable node id (host name or -i), keys the retained topics */
     // uint32_t tick_ct;
 };
 
@@ -85,6 +130,18 @@ static void print_usage(const char *prog)
        "  -P --pass : mqtt password\n"
        "  -d --dummy : dummy telex mode: send messages to console\n"
        "  -b --buffer : set line buffer at X lines \n"
+       "  -M --memory : bytes of message buffer, preallocated at startup (default 1048576)\n"
+       "  -B --baud : telex baud rate: 45.45, 50 (default), 75 or 100\n"
+       "  -C --calfile : stop time calibration file (default " TELEX_CALIBRATION_FILE ")\n"
+       "  -w --warmup : power up the telex during startup so the first message prints without delay\n"
+       "  -v --verbosity : log level 0=error 1=warning 2=info 3=debug 4=trace\n"
+       "  -V --vcd : capture all GPIO activity and write it to this VCD file on exit\n"
+       "  -g --group : share the incoming topics with all gateways in this group (MQTT shared subscription),\n"
+       "               each message is printed by one gateway of the group only\n"
+       "  -F --filter : ingest filter rules (drop, rewrite, trim, minprint), see telexFilter.h\n"
+       "  -W --weight : topic=weight, share of print time for messages on a topic (default 1), repeatable\n"
+       "  -R --realtime : real-time bit timing on this CPU core (-1: any core): SCHED_FIFO, locked memory\n"
+       "  -i --node : node id of the status topic (default: host name), stays the same across restarts\n"
   		 "  -h --help : display this message\n");
 	exit(1);
 }
@@ -96,6 +153,16 @@ char *hostname;
 int port;
 int dummyMode=0;
 unsigned long maxbuffer=10;
+unsigned long maxbytes=TELEX_QUEUE_DEFAULT_BUDGET;
+const char *baudrate="50";
+const char *calfile=TELEX_CALIBRATION_FILE;
+int warmup=0;
+char *vcdfile;
+char *group;
+int realtime=-2;                /* CPU core of the print loop, -2 = no real-time mode */
+char *nodeid;
+telexFilter *filter;
+telexQueue messagequeue;
 
 char *username;
 char *password;
@@ -109,6 +176,17 @@ static void parse_opts(int argc, char *argv[])
     { "user", no_argument, 0, 'u' },
     { "pass", no_argument, 0, 'P' },
     { "buffer", no_argument, 0, 'b' },
+    { "memory", required_argument, 0, 'M' },
+    { "baud", required_argument, 0, 'B' },
+    { "calfile", required_argument, 0, 'C' },
+    { "warmup", no_argument, 0, 'w' },
+    { "verbosity", required_argument, 0, 'v' },
+    { "vcd", required_argument, 0, 'V' },
+    { "weight", required_argument, 0, 'W' },
+    { "group", required_argument, 0, 'g' },
+    { "filter", required_argument, 0, 'F' },
+    { "realtime", required_argument, 0, 'R' },
+    { "node", required_argument, 0, 'i' },
 		{ "help", no_argument, 0, 'h' },
 		{ NULL, 0, 0, 0 }
 	};
@@ -117,7 +195,7 @@ static void parse_opts(int argc, char *argv[])
 
 	while (1)
 	{
-		c = getopt_long(argc, argv, "n:p:u:P:db:h", lopts, NULL);
+		c = getopt_long(argc, argv, "n:p:u:P:db:M:B:C:wv:V:W:g:F:R:i:h", lopts, NULL);
 		if (c==-1)
 		{
       if(hostname==0||port==0) {
@@ -149,6 +227,51 @@ static void parse_opts(int argc, char *argv[])
       case 'b':
         maxbuffer=atoi(optarg);
 				break;
+      case 'M':
+        maxbytes=strtoul(optarg,NULL,0);
+				break;
+      case 'B':
+        baudrate=optarg;
+				break;
+      case 'C':
+        calfile=optarg;
+				break;
+      case 'w':
+        warmup=1;
+				break;
+      case 'v':
+        telexLogSetLevel(atoi(optarg));
+				break;
+      case 'V':
+        vcdfile=optarg;
+				break;
+      case 'g':
+        group=optarg;
+				break;
+      case 'F':
+        filter=new telexFilter();
+        if(!filter->load(optarg)) {
+          printf("Invalid parameters: unable to load filter rules from %s\n",optarg);
+          exit(1);
+        }
+				break;
+      case 'R':
+        realtime=atoi(optarg);
+        if(realtime<0) realtime=-1;
+				break;
+      case 'i':
+        nodeid=optarg;
+				break;
+      case 'W':
+        {
+          const char *weight=strrchr(optarg,'=');
+          if(weight==0||weight==optarg||atoi(weight+1)<=0) {
+            printf("Invalid parameters: weight must be given as topic=weight\n");
+            print_usage(argv[0]);
+          }
+          messagequeue.setWeight(std::string(optarg,weight-optarg),atoi(weight+1));
+        }
+				break;
 			case 'h':
 			default:
 				print_usage(argv[0]);
@@ -157,30 +280,157 @@ static void parse_opts(int argc, char *argv[])
 }
 
 telex *pDaTelex=0;
+telexPrinter *printer=0;
 long messagecounter=0;
-vector <string> messagequeue;
 
 void handle_signal (int x)
 {
   exit(x); // -> calls ceannup via atexit
 }
 
+struct mosquitto *m = 0;
+std::atomic<bool> subscribed(false);    /* the broker acknowledged every subscription of the connect */
+int pendingsubscriptions = 0;           /* subscriptions not acknowledged yet (network callbacks only) */
+std::thread telex_thread;               /* startup stage: GPIO and power up (init_telex) */
+bool loopthread = false;        /* network runs on the mosquitto thread (mosquitto_loop_start) */
+
+/* The network thread (on_message), the status thread and the print loop share the queue, the
+ * lock inherits priority as the print loop may run real-time (-R). Control commands are
+ * handed to the print loop, which checks for them after every printed character. */
+telexRealtimeMutex queuelock;
+std::condition_variable_any queueready;
+std::deque<std::string> controlcommands;
+std::atomic<bool> interrupt(false);     /* stop printing after the current character */
+std::atomic<bool> paused(false);
+std::atomic<bool> halted(false);
+std::atomic<bool> announce(true);       /* republish status and capacity, e.g. after a reconnect */
+
+/* Printer state for the status thread, set by the print loop (which owns the printer). */
+std::atomic<size_t> printjobs(0);
+std::atomic<size_t> printbacklog(0);    /* bytes handed to the printer but not printed yet */
+std::thread statusthread;
+
+/* Outcome of a control command, answered by the status thread (not on the print loop). */
+struct control_reply {
+    std::string command;
+    bool known;
+    long flushed;               /* flush: messages and print jobs thrown away, otherwise -1 */
+    bool paused;
+    bool power;
+    unsigned long queue;
+    unsigned long jobs;
+};
+std::deque<struct control_reply> controlreplies; /* under queuelock */
+
+/* Last published status, republished only when one of these changes. */
+struct gateway_status {
+    const char *state;          /* online, busy or offline */
+    bool accepting;
+    int level;                  /* fill level in STATUS_LEVELS steps */
+    bool valid;
+};
+struct gateway_status laststatus;
+char statustopic[HOST_NAME_MAX + 32];
+char capacitytopic[HOST_NAME_MAX + 32];
+
+static void clear_status(struct mosquitto *m);
+static void clear_capacity(struct mosquitto *m);
+
 void cleanup_resources ()
 {
+  if(telex_thread.joinable()) {
+    /* a failed broker connect exits while the telex may still be powering up */
+    telex_thread.join();
+  }
+  if(statusthread.joinable()) {
+    halted = true;              /* no status after it is cleared */
+    statusthread.join();
+  }
+  if(m!=0 && subscribed) {
+    /* a clean exit does not trigger the last will */
+    clear_status(m);
+    clear_capacity(m);
+    if (loopthread) {
+      mosquitto_disconnect(m);
+      mosquitto_loop_stop(m, false);
+      loopthread = false;
+    } else {
+      mosquitto_loop(m, 100, 1);
+      mosquitto_disconnect(m);
+    }
+    subscribed = false;
+  }
+  if(filter!=0) {
+    filter->logStats();
+  }
   if(pDaTelex!=0) {
     pDaTelex->sendString((uint8_t*) "\n");
     pDaTelex->setPower(0);
+    if (vcdfile != 0 && !pDaTelex->writeCapture(vcdfile)) {
+      telexLog(TELEX_LOG_ERROR, TELEX_LOG_GENERAL, "Unable to write capture file %s\n", vcdfile);
+    }
   }
 }
 
-struct mosquitto *m = 0;
+/* Duration of the startup stages in milliseconds. */
+struct startup_timing {
+    double gpio;
+    double warmup;
+    double broker;
+    double total;
+};
+
+static double elapsed_ms(const struct timespec *start) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) * 1000.0 + (now.tv_nsec - start->tv_nsec) / 1000000.0;
+}
+
+/* Startup stage run next to the broker connect: map the GPIO registers,
+ * set up the pins and optionally power up the telex. */
+static void init_telex(struct startup_timing *timing, const char **error) {
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    telex *t;
+    try {
+      t=new telex();
+    } catch (std::exception &e) {
+      *error = e.what();
+      return;
+    }
+    if (!t->setBaudrate(baudrate)) {
+      *error = "unsupported baud rate";
+      delete t;                 /* unmaps the GPIO registers */
+      return;
+    }
+    if (vcdfile != 0) {
+      t->enableCapture(CAPTURE_DEFAULT_EVENTS);
+    }
+    if (t->loadCalibration(calfile)) {
+      telexLog(TELEX_LOG_INFO, TELEX_LOG_GENERAL, "Using calibrated stop time of %ld us\n", t->stopTime);
+    }
+    timing->gpio = elapsed_ms(&start);
+
+    if (warmup) {
+      clock_gettime(CLOCK_MONOTONIC, &start);
+      t->setPower(1);
+      timing->warmup = elapsed_ms(&start);
+    }
+    pDaTelex=t; /* only published once ready, cleanup_resources may run on a failed broker connect */
+}
 
 int main(int argc, char **argv) {
+    telexLogStart();
+    telexLogSetRateLimit(TELEX_LOG_MQTT, MQTT_LOG_RATE_LIMIT);
+    atexit (telexLogStop); /* runs after cleanup_resources */
     atexit (cleanup_resources);
     signal(SIGINT, handle_signal); // catch ctrl+c for cleanup
     signal(SIGABRT, handle_signal); // catch abort for cleanup
 
     parse_opts(argc, argv);
+    messagequeue.maxMessages = maxbuffer;
+    messagequeue.setBudget(maxbytes);
 
     if(hostname==0) {
       return 0;
@@ -188,13 +438,25 @@ int main(int argc, char **argv) {
 
     pid_t pid = getpid();
 
+    /* Telex setup (GPIO, power up) and broker connect run concurrently. */
+    struct startup_timing timing;
+    struct timespec start;
+    const char *telex_error = NULL;
+    memset(&timing, 0, sizeof(timing));
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    pDaTelex=0;
     if(dummyMode==0) {
-      pDaTelex=new telex();
-      // pDaTelex=0;
-    } else {
-      pDaTelex=0;
+      /* signals go to this thread, cleanup_resources joins the startup stage */
+      sigset_t block, previous;
+      sigfillset(&block);
+      pthread_sigmask(SIG_BLOCK, &block, &previous);
+      telex_thread = std::thread(init_telex, &timing, &telex_error);
+      pthread_sigmask(SIG_SETMASK, &previous, NULL);
     }
 
+    struct timespec broker_start;
+    clock_gettime(CLOCK_MONOTONIC, &broker_start);
     mosquitto_lib_init();
 
     struct client_info info;
@@ -207,14 +469,40 @@ int main(int argc, char **argv) {
     info.m = m;
 
     if(0!=username) {
-      printf("Setting username to '%s'\n", username);
+      telexLog(TELEX_LOG_INFO, TELEX_LOG_GENERAL, "Setting username to '%s'\n", username);
       mosquitto_username_pw_set(m, username, password);
     }
 
     if (!set_callbacks(m)) { die("set_callbacks() failure\n"); }
 
+    /* Last will: the broker marks the gateway offline when the connection dies without a disconnect. */
+    snprintf(statustopic, sizeof(statustopic), TELEX_STATUS, info.node);
+    snprintf(capacitytopic, sizeof(capacitytopic), TELEX_CAPACITY, info.node);
+    const char *will = "{\"state\":\"offline\",\"accepting\":false}";
+    mosquitto_will_set(m, statustopic, strlen(will), will, 1, true);
+
     if (!connect(m)) { die("connect() failure\n"); }
 
+    /* Process the CONNACK and the SUBACKs, so the subscriptions are in place before printing starts. */
+    int maxloops = 50;
+    while (!subscribed && mosquitto_loop(m, 100, 1) == MOSQ_ERR_SUCCESS && --maxloops > 0) {}
+    timing.broker = elapsed_ms(&broker_start);
+
+    if (telex_thread.joinable()) {
+      telex_thread.join();
+    }
+    if (telex_error != NULL) {
+      fprintf(stderr, "%s\n", telex_error);
+      die("telex init failure\n");
+    }
+    if (pDaTelex != 0) {
+      printer = new telexPrinter(pDaTelex);
+    }
+    timing.total = elapsed_ms(&start);
+    telexLog(TELEX_LOG_INFO, TELEX_LOG_GENERAL, "Startup: gpio %.0f ms, warm-up %.0f ms, broker %.0f ms, total %.0f ms (%.0f ms saved by running in parallel)\n",
+           timing.gpio, timing.warmup, timing.broker, timing.total,
+           timing.gpio + timing.warmup + timing.broker - timing.total);
+
     int res = run_loop(&info);
 
     mosquitto_lib_cleanup();
@@ -234,29 +522,165 @@ static void die(const char *msg) {
 /* Initialize a mosquitto client. */
 static struct mosquitto *init(struct client_info *info) {
     void *udata = (void *)info;
-    int buf_sz = 32;
-    char buf[buf_sz];
-    if (buf_sz < snprintf(buf, buf_sz, "client_%d", info->pid)) {
+    if (nodeid != 0 && strlen(nodeid) >= sizeof(info->node)) {
+        fprintf(stderr, "Invalid parameters: node id longer than %d characters\n", HOST_NAME_MAX);
+        return NULL;
+    }
+    if (gethostname(info->host, sizeof(info->host)) != 0) {
+        /* a made up name would be shared by every such gateway, and with it the retained records */
+        if (nodeid == 0) {
+            fprintf(stderr, "Unable to get the host name (%s), give the node id with -i\n", strerror(errno));
+            return NULL;
+        }
+        snprintf(info->host, sizeof(info->host), "%s", nodeid);
+    }
+    info->host[sizeof(info->host) - 1] = 0;
+    /* the retained topics are keyed on the node, so a restart replaces its records */
+    snprintf(info->node, sizeof(info->node), "%s", nodeid ? nodeid : info->host);
+    if ((int)sizeof(info->id) <= snprintf(info->id, sizeof(info->id), "telex_%s_%d", info->host, info->pid)) {
         return NULL;            /* snprintf buffer failure */
     }
-    /* Create a new mosquitto client, with the name "client_#{PID}". */
-    struct mosquitto *m = mosquitto_new(buf, true, udata);
+    /* Create a new mosquitto client, with the name "telex_#{HOSTNAME}_#{PID}"
+     * (the pid alone collides between gateways on different hosts). */
+    struct mosquitto *m = mosquitto_new(info->id, true, udata);
+#ifdef MQTT_PROTOCOL_V5
+    /* Shared subscriptions are part of MQTT 5 (most brokers also accept them from 3.1.1 clients). */
+    if (m != NULL && group != 0) {
+        mosquitto_int_option(m, MOSQ_OPT_PROTOCOL_VERSION, MQTT_PROTOCOL_V5);
+    }
+#endif
 
     return m;
 }
 
+/* Subscribe to a topic, subscribed turns true once the broker acknowledged all of them. */
+static void subscribe(struct mosquitto *m, const char *topic) {
+    if (mosquitto_subscribe(m, NULL, topic, 0) == MOSQ_ERR_SUCCESS) {
+        pendingsubscriptions++;
+    }
+}
+
+/* Subscribe to an incoming topic, shared with the other gateways of the group if one is set.
+ * The broker then hands every message to one member of the group only. */
+static void subscribe_incoming(struct mosquitto *m, const char *topic) {
+    if (group == 0) {
+        subscribe(m, topic);
+        return;
+    }
+    std::string shared(strlen(TELEX_SHARED_PREFIX) + strlen(group), 0);
+    shared.resize(snprintf(&shared[0], shared.size(), TELEX_SHARED_PREFIX, group));
+    shared += topic;
+    subscribe(m, shared.c_str());
+}
+
+/* Characters per second the gateway prints. */
+static double print_rate(void) {
+    if (pDaTelex == 0) {
+        return SIM_BAUDRATE;
+    }
+    /* start bit, 5 data bits and the stop time */
+    return 1000000.0 / (6 * pDaTelex->symbolTime + pDaTelex->stopTime);
+}
+
+/* Fill level of the queue: messages or buffer, whichever is closer to its limit. The buffer
+ * is counted in whole chunks as the queue does when it makes room, not in payload bytes. */
+static double queue_fill(void) {
+    double fill = messagequeue.budget() ? (double)messagequeue.usedBytes() / messagequeue.budget() : 1;
+    if (messagequeue.maxMessages && (double)messagequeue.size() / messagequeue.maxMessages > fill) {
+        fill = (double)messagequeue.size() / messagequeue.maxMessages;
+    }
+    return fill;
+}
+
+/* Queue figures of the status and capacity records, taken under the queue lock and published
+ * without holding it. */
+struct queue_figures {
+    unsigned long messages;
+    unsigned long bytes;        /* buffer in use */
+    double cost;                /* queued messages and the printer backlog, in characters */
+    double fill;
+};
+
+/* Publish the retained status record, so producers can throttle or reroute before messages
+ * are dropped: state, queue depth, estimated drain time and whether messages are accepted. */
+static void publish_status(struct mosquitto *m, const char *state, const struct queue_figures *figures) {
+    char payload[256];
+    int len = snprintf(payload, sizeof(payload),
+                       "{\"state\":\"%s\",\"queue\":%lu,\"bytes\":%lu,\"drain_s\":%.1f,\"accepting\":%s}",
+                       state, figures->messages, figures->bytes,
+                       figures->cost / print_rate(), laststatus.accepting ? "true" : "false");
+    mosquitto_publish(m, NULL, statustopic, len, payload, 1, true);
+    telexLog(TELEX_LOG_INFO, TELEX_LOG_MQTT, "Status %s\n", payload);
+}
+
+/* Remove the retained status on a clean exit (an empty retained message deletes it), the
+ * last will only covers a connection that dies. */
+static void clear_status(struct mosquitto *m) {
+    mosquitto_publish(m, NULL, statustopic, 0, NULL, 1, true);
+    telexLog(TELEX_LOG_INFO, TELEX_LOG_MQTT, "Status cleared\n");
+}
+
+/* Republish the status when the state, the accepting flag or the fill level step changes
+ * (not on every message). */
+static void update_status(struct mosquitto *m, const struct queue_figures *figures) {
+    const char *state = (figures->messages > 0 || printjobs > 0) ? "busy" : "online";
+    double fill = figures->fill;
+    bool accepting = laststatus.valid ? laststatus.accepting : true;
+    if (accepting && fill >= STATUS_HIGH_WATER) {
+        accepting = false;
+    } else if (!accepting && fill <= STATUS_LOW_WATER) {
+        accepting = true;
+    }
+    int level = (int)(fill * STATUS_LEVELS);
+    if (level > STATUS_LEVELS) {
+        level = STATUS_LEVELS;
+    }
+
+    if (laststatus.valid && laststatus.state == state && laststatus.accepting == accepting && laststatus.level == level) {
+        return;
+    }
+    laststatus.state = state;
+    laststatus.accepting = accepting;
+    laststatus.level = level;
+    laststatus.valid = true;
+    publish_status(m, state, figures);
+}
+
+/* Announce what this gateway can print (retained, so new publishers see it at once):
+ * characters per second and the seconds of print time already queued. */
+static void publish_capacity(struct client_info *info, const struct queue_figures *figures) {
+    double cps = print_rate();
+    char payload[256];
+    int len = snprintf(payload, sizeof(payload),
+                       "{\"id\":\"%s\",\"node\":\"%s\",\"group\":\"%s\",\"cps\":%.2f,\"queue\":%lu,\"backlog_s\":%.1f}",
+                       info->id, info->node, group ? group : "", cps, figures->messages, figures->cost / cps);
+    mosquitto_publish(info->m, NULL, capacitytopic, len, payload, 0, true);
+}
+
+/* Remove the retained capacity on a clean exit, publishers stop counting the gateway. */
+static void clear_capacity(struct mosquitto *m) {
+    mosquitto_publish(m, NULL, capacitytopic, 0, NULL, 1, true);
+}
+
 /* Callback for successful connection: add subscriptions. */
 static void on_connect(struct mosquitto *m, void *udata, int res) {
     if (res == 0) {             /* success */
         struct client_info *info = (struct client_info *)udata;
-        mosquitto_subscribe(m, NULL, TELEX_INCOMING_FROM_SAT, 0);
-        mosquitto_subscribe(m, NULL, TELEX_CONTROL_ALL, 0);
-        int sz = 32;
+        subscribed = false;
+        pendingsubscriptions = 0;
+        subscribe_incoming(m, TELEX_INCOMING_FROM_SAT_ALL);
+        subscribe_incoming(m, TELEX_INCOMING_ALERT);
+        subscribe_incoming(m, TELEX_INCOMING_ITA2_ALL);
+        subscribe(m, TELEX_CONTROL_ALL);
+        int sz = 128;
         char control_pid[sz];
         if (sz < snprintf(control_pid, sz, TELEX_CONTROL_PID, info->pid)) {
             die("snprintf\n");
         }
-        mosquitto_subscribe(m, NULL, control_pid, 0);
+        subscribe(m, control_pid);
+        snprintf(control_pid, sz, TELEX_CONTROL_ID, info->id);
+        subscribe(m, control_pid);
+        announce = true;        /* after every (re)connect: the broker may have published the last will */
 //        mosquitto_subscribe(m, NULL, "tick", 0);
     } else {
         die("connection refused\n");
@@ -276,6 +700,9 @@ static bool match(const char *topic, const char *key) {
 static void on_subscribe(struct mosquitto *m, void *udata, int mid,
                          int qos_count, const int *granted_qos) {
     LOG("-- subscribed successfully\n");
+    if (pendingsubscriptions > 0 && --pendingsubscriptions == 0) {
+        subscribed = true;
+    }
 }
 
 void on_log(struct mosquitto *mosq, void *userdata, int level, const char *str)
@@ -291,17 +718,98 @@ static bool connect(struct mosquitto *m) {
     return res == MOSQ_ERR_SUCCESS;
 }
 
+/* Queue an incoming payload: plain text as it is, an envelope (see telexEnvelope.h) with its
+ * priority, time to live, color and header. The text then passes the ingest filter (-F).
+ * The envelope is parsed in place, the text is only copied when it has escapes, is rewritten
+ * by the filter or gets a header. */
+static void queue_payload(struct client_info *info, const char *topic, const char *payload, size_t len, uint8_t priority) {
+    static telexDedup dedup;
+    telexEnvelope envelope;
+    const char *text = payload;
+    size_t textlen = len;
+    std::string decoded, filtered;
+    uint8_t color = TELEX_COLOR_BLACK;
+    time_t expires = 0;
+    bool isenvelope = telexParseEnvelope(payload, len, &envelope);
+
+    if (isenvelope) {
+        if (envelope.id.data != 0 && dedup.seen(envelope.id)) {
+            telexLog(TELEX_LOG_INFO, TELEX_LOG_MQTT, "Skipping duplicate message %.*s\n", (int)envelope.id.length, envelope.id.data);
+            return;
+        }
+        if (envelope.printer.data != 0 && !telexViewEquals(envelope.printer, info->host) &&
+            !telexViewEquals(envelope.printer, info->node) && !telexViewEquals(envelope.printer, info->id)) {
+            telexLog(TELEX_LOG_INFO, TELEX_LOG_MQTT, "Skipping message for printer %.*s\n", (int)envelope.printer.length, envelope.printer.data);
+            return;
+        }
+        if (envelope.priority >= 0) {
+            priority = (envelope.priority < TELEX_PRIORITIES) ? envelope.priority : TELEX_PRIORITIES - 1;
+        }
+        if (envelope.color == TELEX_COLOR_RED) {
+            color = TELEX_COLOR_RED;
+        }
+        if (envelope.ttl >= 0) {
+            expires = time(NULL) + envelope.ttl;
+        }
+        text = envelope.text.data;
+        textlen = envelope.text.length;
+        if (envelope.text.escaped) {
+            telexViewString(envelope.text, decoded);
+            text = decoded.c_str();
+            textlen = strnlen(text, decoded.length());
+        }
+    }
+
+    if (filter != 0) {
+        uint8_t changed;
+        if (!filter->apply(text, textlen, filtered, &changed)) {
+            return;
+        }
+        if (changed) {
+            text = filtered.c_str();
+            textlen = filtered.length();
+        }
+    }
+
+    if (!isenvelope || envelope.header.data == 0) {
+        messagequeue.push(text, textlen, priority, topic, color, expires);
+        return;
+    }
+    std::string format, withheader;
+    char header[256];
+    time_t now = time(NULL);
+    telexViewString(envelope.header, format);
+    size_t headerlen = strftime(header, sizeof(header), format.c_str(), localtime(&now));
+    withheader.append(header, headerlen);
+    withheader += '\n';
+    withheader.append(text, textlen);
+    messagequeue.push(withheader.c_str(), withheader.length(), priority, topic, color, expires);
+}
+
+/* Queue a packed ITA2 payload (see telex::unpackSymbols): the symbols skip transliteration,
+ * layout and the filter and are sent as they are, shifts included. The stream starts in the
+ * letter alphabet on a fresh line and is rejected when it would print past the end of a line. */
+static void queue_symbols(const char *topic, const uint8_t *payload, size_t len) {
+    std::string symbols(len * TELEX_PACKED_GROUP_SYMBOLS / TELEX_PACKED_GROUP_BYTES, 0);
+    symbols.resize(telex::unpackSymbols(payload, len, (uint8_t *)&symbols[0]));
+    uint8_t alphabet = 1, cursorPos = 0;
+    if (!telex::checkSymbols((const uint8_t *)symbols.data(), symbols.length(), &alphabet, &cursorPos)) {
+        telexLog(TELEX_LOG_WARNING, TELEX_LOG_MQTT, "Rejecting ITA2 message of %lu symbols from %s (line longer than %d columns)\n",
+                 (unsigned long)symbols.length(), topic, TELEX_LINE_WIDTH);
+        return;
+    }
+    messagequeue.push(symbols.data(), symbols.length(), TELEX_PRIORITY_NORMAL, topic, TELEX_COLOR_BLACK, 0, TELEX_FORMAT_ITA2);
+}
+
 /* Handle a message that just arrived via one of the subscriptions. */
 static void on_message(struct mosquitto *m, void *udata,
                        const struct mosquitto_message *msg) {
     if (msg == NULL) { return; }
 
-    printf("Received '%s'\n", (char *) msg->payload);
-
-    if(messagequeue.size()>maxbuffer) {
-      unsigned long ntoskip = messagequeue.size() > maxbuffer ? messagequeue.size() - maxbuffer : 0;
-      printf("I threw away %ld items\n", ntoskip);
-      messagequeue.erase(messagequeue.begin(), messagequeue.begin() + ntoskip-1);
+    if (match(msg->topic, TELEX_INCOMING_ITA2)) {
+        telexLog(TELEX_LOG_INFO, TELEX_LOG_MQTT, "Received %d bytes of ITA2\n", msg->payloadlen);
+    } else {
+        telexLog(TELEX_LOG_INFO, TELEX_LOG_MQTT, "Received '%s'\n", (char *) msg->payload);
     }
 
     // printf("start message handler [%ld]\n", ++messagecounter);
@@ -309,26 +817,32 @@ static void on_message(struct mosquitto *m, void *udata,
     //     (char *) msg->topic, msg->payloadlen, msg->qos, msg->retain ? "R" : "!r",
     //     (char *) msg->payload);
 
-//    struct client_info *info = (struct client_info *)udata;
-
-    if (match(msg->topic, TELEX_INCOMING_FROM_SAT)) {
-        std::string tmpstr = (char *) msg->payload;
-        messagequeue.push_back(tmpstr);
-    } else if (match(msg->topic, TELEX_CONTROL_ALL)) {
-        LOG("incoming from control: %s\n", (char *) msg->payload);
-        /* This will cover both "control/all" and "control/$(PID)".
-         * We won'st see "control/$(OTHER_PID)" because we won't be
-         * subscribed to them.*/
-        if (0 == strncmp((char *) msg->payload, "halt", msg->payloadlen)) {
-            LOG("*** halt\n");
-            (void)mosquitto_disconnect(m);
-        } else {
-          std::string base=(char *) msg->payload;
-          printf("Dummy Telex says: control message received '%s'\n", (char *) base.c_str());
-        }
+    struct client_info *info = (struct client_info *)udata;
+
+    std::unique_lock<telexRealtimeMutex> guard(queuelock);
+    if (match(msg->topic, TELEX_INCOMING_FROM_SAT) && msg->payloadlen > 0) {
+        /* Every topic (telex/incoming-sat/<station>) is a source of its own for fair queuing. */
+        queue_payload(info, msg->topic, (char *) msg->payload, strnlen((char *) msg->payload, msg->payloadlen), TELEX_PRIORITY_NORMAL);
+    } else if (match(msg->topic, TELEX_INCOMING_ALERT) && msg->payloadlen > 0) {
+        /* Alerts preempt the message being printed at its next line break. */
+        queue_payload(info, msg->topic, (char *) msg->payload, strnlen((char *) msg->payload, msg->payloadlen), TELEX_PRIORITY_ALERT);
+    } else if (match(msg->topic, TELEX_INCOMING_ITA2) && msg->payloadlen > 0) {
+        /* Binary: the payload may contain 0 bytes. */
+        queue_symbols(msg->topic, (const uint8_t *) msg->payload, msg->payloadlen);
+    } else if (match(msg->topic, TELEX_CONTROL) && msg->payloadlen > 0) {
+        /* This covers "control/all", "control/$(PID)" and "control/$(CLIENT ID)", other
+         * gateways' control topics are not subscribed. The command is not queued behind
+         * the messages: the print loop stops after the current character and runs it. */
+        std::string command((char *) msg->payload, strnlen((char *) msg->payload, msg->payloadlen));
+        LOG("incoming from control: %s\n", command.c_str());
+        controlcommands.push_back(command);
+        interrupt = true;
     }
 
-    printf("end message handler (queue of %ld messages)\n", messagequeue.size());
+    telexLog(TELEX_LOG_INFO, TELEX_LOG_MQTT, "end message handler (queue of %ld messages, %ld of %ld bytes)\n",
+              messagequeue.size(), messagequeue.sizeBytes(), messagequeue.budget());
+    guard.unlock();
+    queueready.notify_one();
 }
 
 /* Register the callbacks that the mosquitto connection will use. */
@@ -342,50 +856,247 @@ static bool set_callbacks(struct mosquitto *m) {
     return true;
 }
 
-/* Loop until it is explicitly halted or the network is lost, then clean up. */
-static int run_loop(struct client_info *info) {
-//    int res = mosquitto_loop_forever(info->m, 1000, 1 /* unused */);
-    int res;
+/* The command as a JSON string value: at most CONTROL_ECHO_BYTES of it (not cutting a UTF-8
+ * sequence), quotes, backslashes and control characters escaped. */
+static std::string json_command(const std::string &command) {
+    size_t length = command.length();
+    if (length > CONTROL_ECHO_BYTES) {
+        length = CONTROL_ECHO_BYTES;
+        while (length > 0 && ((uint8_t)command[length] & 0xC0) == 0x80) {
+            length--;
+        }
+    }
+    std::string out;
+    for (size_t zz = 0; zz < length; zz++) {
+        uint8_t c = command[zz];
+        if (c == '"' || c == '\\') {
+            out += '\\';
+            out += (char)c;
+        } else if (c < 0x20) {
+            char escape[8];
+            snprintf(escape, sizeof(escape), "\\u%04x", c);
+            out += escape;
+        } else {
+            out += (char)c;
+        }
+    }
+    return out;
+}
+
+/* Publish the result of a control command on the reply topic. */
+static void reply_control(struct client_info *info, const std::string &command, const char *result, const char *detail) {
+    char topic[128];
+    char payload[512];
+    snprintf(topic, sizeof(topic), TELEX_CONTROL_REPLY, info->id);
+    int len = snprintf(payload, sizeof(payload), "{\"command\":\"%s\",\"result\":\"%s\",%s}",
+                       json_command(command).c_str(), result, detail);
+    mosquitto_publish(info->m, NULL, topic, len, payload, 1, false);
+    telexLog(TELEX_LOG_INFO, TELEX_LOG_MQTT, "Control %s\n", payload);
+}
 
-    while(1)
+/* Run the control commands received since the last character (on the print loop, which owns
+ * the GPIO pins and the printer). The replies are published by the status thread. */
+static void run_control_commands(void) {
+    std::deque<std::string> commands;
+    interrupt = paused.load();
     {
-      unsigned long lastcount=0;
-      unsigned int maxloops=25;
-      do {
-        lastcount = messagequeue.size();
-        res = mosquitto_loop(info->m, 100, 1 /* unused */);
-        if(res!=0) {
-          printf("connection to MQTT broker lost (%d). Attempting reconnect", res);
-          if (!connect(m)) {
-            printf("unable to connect to MQTT broker. Will retry in 60 seconds\n");
-            sleep(60);
-          }
+        std::lock_guard<telexRealtimeMutex> guard(queuelock);
+        commands.swap(controlcommands);
+    }
+
+    for (size_t zz = 0; zz < commands.size(); zz++) {
+        struct control_reply reply;
+        reply.command.swap(commands[zz]);
+        const std::string &command = reply.command;
+        reply.known = true;
+        reply.flushed = -1;
+        if (command == "halt") {
+            LOG("*** halt\n");
+            halted = true;
+        } else if (command == "pause") {
+            paused = true;
+            interrupt = true;
+        } else if (command == "resume") {
+            paused = false;
+            interrupt = false;
+        } else if (command == "flush") {
+            size_t jobs = (printer != 0) ? printer->clear() : 0;
+            std::lock_guard<telexRealtimeMutex> guard(queuelock);
+            reply.flushed = messagequeue.clear() + jobs;
+        } else if (command == "skip") {
+            if (printer != 0) {
+                printer->skip();
+            }
+        } else if (command == "power on" || command == "power off") {
+            if (pDaTelex != 0 && pDaTelex->getPower() != (command == "power on")) {
+                pDaTelex->setPower(command == "power on");
+            }
+            if (command == "power off") {
+                paused = true;  /* printing would switch the power on again */
+                interrupt = true;
+            }
+        } else if (command != "status") {
+            reply.known = false;
+        }
+        reply.paused = paused;
+        reply.power = pDaTelex != 0 && pDaTelex->getPower();
+        reply.jobs = (printer != 0) ? printer->pending() : 0;
+        std::lock_guard<telexRealtimeMutex> guard(queuelock);
+        reply.queue = messagequeue.size();
+        controlreplies.push_back(reply);
+    }
+}
+
+/* Publish the replies to the control commands run since the last call. */
+static void send_control_replies(struct client_info *info) {
+    std::deque<struct control_reply> replies;
+    {
+        std::lock_guard<telexRealtimeMutex> guard(queuelock);
+        replies.swap(controlreplies);
+    }
+
+    for (size_t zz = 0; zz < replies.size(); zz++) {
+        const struct control_reply &reply = replies[zz];
+        char detail[160];
+        if (!reply.known) {
+            reply_control(info, reply.command, "error", "\"error\":\"unknown command\"");
+            continue;
+        }
+        if (reply.flushed >= 0) {
+            snprintf(detail, sizeof(detail), "\"flushed\":%ld", reply.flushed);
+        } else {
+            snprintf(detail, sizeof(detail), "\"paused\":%s,\"power\":%s,\"queue\":%lu,\"jobs\":%lu",
+                     reply.paused ? "true" : "false", reply.power ? "true" : "false", reply.queue, reply.jobs);
+        }
+        reply_control(info, reply.command, "ok", detail);
+    }
+}
+
+/* Keep the status and capacity records up to date and answer control commands. Runs on a
+ * thread of normal priority: the print loop may run real-time and must not format and publish. */
+static void status_loop(struct client_info *info) {
+    time_t lastcapacity = 0;
+
+    while (!halted) {
+        struct queue_figures figures;
+        {
+            std::lock_guard<telexRealtimeMutex> guard(queuelock);
+            figures.messages = messagequeue.size();
+            figures.bytes = messagequeue.usedBytes();
+            figures.cost = messagequeue.cost() + printbacklog;
+            figures.fill = queue_fill();
         }
-      } while (lastcount!=messagequeue.size()&&--maxloops>0);
+        if (announce.exchange(false)) {
+            laststatus.valid = false;
+            lastcapacity = 0;
+        }
+        send_control_replies(info);
+        update_status(info->m, &figures);
+        if (difftime(time(NULL), lastcapacity) >= CAPACITY_INTERVAL) {
+            publish_capacity(info, &figures);
+            lastcapacity = time(NULL);
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(STATUS_POLL_MS));
+    }
+    send_control_replies(info); /* halt */
+}
 
-      if(pDaTelex!=0) {
-        pDaTelex->checkPowerTimeout();
+/* Loop until it is explicitly halted, then clean up. The network runs on its own thread
+ * (reconnects included), so control commands are never stuck behind printing. */
+static int run_loop(struct client_info *info) {
+    /* Signals are handled by the print loop: cleanup_resources uses the GPIO pins. */
+    sigset_t block, previous;
+    sigfillset(&block);
+    pthread_sigmask(SIG_BLOCK, &block, &previous);
+    int res = mosquitto_loop_start(info->m);
+    if (res == MOSQ_ERR_SUCCESS) {
+        statusthread = std::thread(status_loop, info);
+    }
+    pthread_sigmask(SIG_SETMASK, &previous, NULL);
+    if (res != MOSQ_ERR_SUCCESS) {
+        telexLog(TELEX_LOG_ERROR, TELEX_LOG_MQTT, "unable to start the network thread (%d)\n", res);
+        return 1;
+    }
+    loopthread = true;
+    if (realtime > -2) {
+        /* only the print loop: the network and status threads are running already and keep their priority */
+        telexRealtimeStart(realtime);
+    }
+
+    while (!halted)
+    {
+      run_control_commands();
+      if (halted) {
+        break;
       }
 
-      if(messagequeue.size()>0) {
-        std::string printmessage = messagequeue[0];
-        messagequeue.erase(messagequeue.begin());
-
-        if(printmessage.length()>0) {
-          if(pDaTelex!=0) {
-            pDaTelex->sendString((uint8_t*) printmessage.c_str());
-            pDaTelex->sendString((uint8_t*)"\n");
-          } else {
-            for (std::string::iterator c = printmessage.begin(); c!=printmessage.end(); ++c) {
-              std::cout << *c << std::flush;
+      bool printed = false;
+      if (printer != 0) {
+        if (!paused) {
+          /* Hand a message to the printer when it is idle, when it outranks the running job or
+           * when the running job is about to end: the printer then continues the run with it. */
+          std::string printmessage;
+          uint8_t priority, color, format;
+          std::unique_lock<telexRealtimeMutex> guard(queuelock);
+          if ((printer->pending()==0 || messagequeue.topPriority()>printer->currentPriority() ||
+               printer->backlog()<TELEX_RUN_AHEAD) &&
+              messagequeue.pop(printmessage, &priority, 0, &color, &format) && printmessage.length()>0) {
+            printer->submit(new telexPrintJob(printmessage.c_str(), printmessage.length(), priority, 1, color, format));
+          }
+          guard.unlock();
+          printed = printer->printLine(&interrupt);
+        }
+        if (!printed) {
+          pDaTelex->checkPowerTimeout();
+        }
+      } else if (!paused) {
+        std::string printmessage;
+        uint8_t format, alphabet = 1;
+        std::unique_lock<telexRealtimeMutex> guard(queuelock);
+        printed = messagequeue.pop(printmessage, 0, 0, 0, &format) && printmessage.length()>0;
+        guard.unlock();
+        if (printed) {
+          for (std::string::iterator c = printmessage.begin(); c!=printmessage.end() && !interrupt; ++c) {
+            if (format == TELEX_FORMAT_ITA2) {
+              /* show the symbols as the telex would print them, shifts and NULL print nothing */
+              uint8_t decoded = (alphabet == 2) ? telex::alphabet2[(uint8_t)*c] : telex::alphabet1[(uint8_t)*c];
+              if (decoded == '^' || decoded == '~') {
+                alphabet = (decoded == '^') ? 1 : 2;
+              }
+              if (decoded == '^' || decoded == '~' || decoded == '*' || decoded == '\r') {
+                continue;
+              }
+              std::cout << decoded << std::flush;
               usleep(1000*1000/SIM_BAUDRATE);
+              continue;
             }
-            std::cout << std::endl;
+            std::cout << *c << std::flush;
+            usleep(1000*1000/SIM_BAUDRATE);
           }
+          std::cout << std::endl;
         }
       }
+
+      if (printer != 0) {
+        printjobs = printer->pending();
+        printbacklog = printer->backlog();
+      }
+      if (!printed) {
+        /* nothing to print (or paused): sleep until a message or command arrives */
+        std::unique_lock<telexRealtimeMutex> guard(queuelock);
+        queueready.wait_for(guard, std::chrono::milliseconds(100));
+      }
     }
 
+    statusthread.join();
+    clear_status(info->m);
+    clear_capacity(info->m);
+    subscribed = false;
+    mosquitto_disconnect(info->m);
+    mosquitto_loop_stop(info->m, false);
+    loopthread = false;
+    res = MOSQ_ERR_SUCCESS;
+
     mosquitto_destroy(info->m);
     (void)mosquitto_lib_cleanup();
 